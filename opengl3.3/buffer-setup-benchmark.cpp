@@ -0,0 +1,144 @@
+/*
+ * == COMPILING ==
+ *
+ * To compile this file with MinGW on Windows, run the following command:
+ *     g++ -std=c++14 -O2 -Wall -lopengl32 -lgdi32 -Iinclude
+ *
+ * == DESCRIPTION ==
+ *
+ * This example measures how long it takes to build and upload a mesh of one million vertices, once the way
+ * BufferType used to do it and once with a pre-sized BufferType and a single upload.
+ *
+ */
+
+#define EXAMPLE_NAME __FILE__
+
+#define APPLICATION_IMPLEMENTATION
+#include "include/application.h"
+#include "include/glmath.h"
+#include "include/glshader.h"
+#include "include/glbuffer.h"
+#include <algorithm>
+#include <chrono>
+
+static const int VertexCount = 1000000;
+static const int Runs = 10;
+
+static struct {
+    ShaderType shader;
+} State;
+
+typedef std::chrono::steady_clock Clock;
+
+static glm::vec3 position(int i)
+{
+    return glm::vec3(float(i % 1000), float(i / 1000), 0.0f);
+}
+
+static glm::vec4 color(int i)
+{
+    return glm::vec4(float(i & 255) / 255.0f, 0.5f, 1.0f, 1.0f);
+}
+
+// The old setup: growing the vector one vertex at a time, then allocating the
+// buffer and filling it in a second call
+static void SetupBefore()
+{
+    std::vector<VertexType> verts;
+    for (int i = 0; i < VertexCount; i++)
+    {
+        verts.push_back(VertexType({ position(i), color(i) }));
+    }
+
+    unsigned int vertexArrayId = 0, vertexBufferId = 0;
+    glGenVertexArrays(1, &vertexArrayId);
+    glGenBuffers(1, &vertexBufferId);
+
+    glBindVertexArray(vertexArrayId);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(verts.size() * sizeof(VertexType)), 0, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(verts.size() * sizeof(VertexType)), verts.data());
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindVertexArray(vertexArrayId);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    State.shader.setupAttributes(sizeof(VertexType), offsetof(VertexType, pos), offsetof(VertexType, col));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glFinish();
+
+    glDeleteBuffers(1, &vertexBufferId);
+    glDeleteVertexArrays(1, &vertexArrayId);
+}
+
+static void SetupAfter()
+{
+    BufferType buffer;
+
+    auto verts = buffer.allocate(VertexCount);
+    for (int i = 0; i < VertexCount; i++)
+    {
+        verts[i].pos = position(i);
+        verts[i].col = color(i);
+    }
+    buffer.setup(GL_POINTS, State.shader);
+
+    glFinish();
+
+    buffer.cleanup();
+}
+
+// Median of the runs in milliseconds
+static float Measure(void (*setup)())
+{
+    std::vector<float> times;
+    for (int run = 0; run < Runs; run++)
+    {
+        auto start = Clock::now();
+        setup();
+        times.push_back(std::chrono::duration<float, std::milli>(Clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+
+    return times[times.size() / 2];
+}
+
+bool Startup()
+{
+    std::cout << EXAMPLE_NAME << " startup()\n";
+
+    State.shader.compileDefaultShader();
+
+    // Warm up the driver before measuring anything
+    SetupAfter();
+
+    std::cout << "setup of " << VertexCount << " vertices, median of " << Runs << " runs\n";
+    std::cout << "    before: " << Measure(SetupBefore) << " ms\n";
+    std::cout << "    after:  " << Measure(SetupAfter) << " ms\n";
+
+    return true;
+}
+
+void Resize(int width, int height)
+{
+    glViewport(0, 0, width, height);
+}
+
+void Destroy()
+{
+    std::cout << EXAMPLE_NAME << " destroy()\n";
+}
+
+bool Tick()
+{
+    return false; // all work is done in Startup()
+}
+
+int main(int argc, char *argv[])
+{
+    auto app = Application::Create(Startup, Resize, Destroy);
+
+    return app->Run(Tick);
+}
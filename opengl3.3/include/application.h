@@ -1,14 +1,93 @@
 #ifndef APPLICATION_H
 #define APPLICATION_H
 
+#include "framestats.h"
 #include <functional>
 #include <iostream>
+#include <vector>
+
+// Draw work recorded on the update thread and replayed on the render thread
+class CommandList
+{
+    std::vector<std::function<void()>> _commands;
+
+public:
+    void Push(std::function<void()> command)
+    {
+        _commands.push_back(std::move(command));
+    }
+
+    void Execute() const
+    {
+        for (auto const &command : _commands)
+        {
+            command();
+        }
+    }
+
+    // Keeps the capacity, so a steady frame does not allocate the list again
+    void Clear()
+    {
+        _commands.clear();
+    }
+
+    size_t Size() const
+    {
+        return _commands.size();
+    }
+};
 
 class Application
 {
+protected:
+    std::function<void(int width, int height)> _resize;
+    std::function<void()> _destroy;
+    FrameStats _frameStats;
+
+    // The list the update thread is recording while RunThreaded() is active
+    CommandList *_recording;
+
+    // Handles pending window events, returns false when the application should quit
+    virtual bool PumpEvents() = 0;
+    virtual void Present() = 0;
+    // Called once after the last frame, while the GL context is still current
+    virtual void Shutdown() = 0;
+
+    // Binds and releases the GL context on the calling thread
+    virtual void MakeCurrent() = 0;
+    virtual void DoneCurrent() = 0;
+
+    // Backends report window size changes here, when a render thread owns the
+    // GL context the resize callback is deferred to that thread
+    void Resized(int width, int height);
+
 public:
+    Application();
     virtual ~Application();
-    virtual int Run(std::function<bool()> tick) = 0;
+    virtual int Run(std::function<bool()> tick);
+
+    // Runs update() on the calling thread while a render thread owns the GL
+    // context. update() records its GL work into the command list, which is
+    // executed and presented by the render thread while the next frame is being
+    // updated. The resize and destroy callbacks run on the thread that owns the
+    // GL context at that moment.
+    int RunThreaded(std::function<bool(CommandList &commands)> update);
+
+    // Calls update() at a fixed rate of updateRate times per second and render()
+    // once per frame. alpha is how far the frame lies between the last update and
+    // the next one, so render() can interpolate between the two simulation states.
+    int Run(std::function<void(double dt)> update, std::function<bool(double alpha)> render, double updateRate = 120.0);
+
+    FrameStats &Stats()
+    {
+        return _frameStats;
+    }
+
+    // 0 presents uncapped, 1 waits for every vertical blank and -1 enables
+    // adaptive vsync (late frames tear instead of waiting for the next blank).
+    // Returns false when the platform does not support the requested interval.
+    virtual bool SetSwapInterval(int interval) = 0;
+
     static Application *Create(std::function<bool()> intialize, std::function<void(int width, int height)> resize, std::function<void()> destroy);
 };
 
@@ -17,20 +96,214 @@ public:
 #ifdef APPLICATION_IMPLEMENTATION
 
 #include "glad.c"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+Application::Application()
+    : _recording(nullptr)
+{ }
+
+Application::~Application() {}
+
+void Application::Resized(int width, int height)
+{
+    if (_recording != nullptr)
+    {
+        auto resize = _resize;
+        _recording->Push([resize, width, height] () { resize(width, height); });
+    }
+    else
+    {
+        _resize(width, height);
+    }
+}
+
+int Application::Run(std::function<bool()> tick)
+{
+    bool running = true;
+
+    while (running)
+    {
+        if (!PumpEvents())
+        {
+            break;
+        }
+
+        _frameStats.BeginFrame();
+
+        running = tick();
+
+        _frameStats.EndTick();
+
+        Present();
+
+        _frameStats.EndFrame();
+    }
+
+    _frameStats.Release();
+
+    Shutdown();
+
+    return 0;
+}
+
+int Application::Run(std::function<void(double dt)> update, std::function<bool(double alpha)> render, double updateRate)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    auto const dt = 1.0 / updateRate;
+
+    // Never catch up more than this per frame, otherwise a slow frame queues
+    // more updates for the next one and the application never recovers
+    auto const maxFrameTime = 0.25;
+
+    auto previous = Clock::now();
+    auto accumulator = 0.0;
+
+    return Run([&] () {
+        auto now = Clock::now();
+        auto frameTime = std::chrono::duration<double>(now - previous).count();
+        previous = now;
+
+        accumulator += std::min(frameTime, maxFrameTime);
+
+        while (accumulator >= dt)
+        {
+            update(dt);
+            accumulator -= dt;
+        }
+
+        return render(accumulator / dt);
+    });
+}
+
+int Application::RunThreaded(std::function<bool(CommandList &commands)> update)
+{
+    CommandList lists[2];
+    CommandList *submitted = nullptr;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    DoneCurrent();
+
+    std::thread renderThread([&] () {
+        MakeCurrent();
+
+        while (true)
+        {
+            CommandList *commands = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [&] () { return submitted != nullptr || stopping; });
+
+                // A submitted list is always rendered, also when stopping
+                if (submitted == nullptr)
+                {
+                    break;
+                }
+                commands = submitted;
+            }
+
+            _frameStats.BeginFrame();
+
+            commands->Execute();
+
+            _frameStats.EndTick();
+
+            Present();
+
+            _frameStats.EndFrame();
+
+            commands->Clear();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                submitted = nullptr;
+            }
+            condition.notify_all();
+        }
+
+        _frameStats.Release();
+
+        DoneCurrent();
+    });
+
+    int back = 0;
+    bool running = true;
+
+    while (running)
+    {
+        // Resize events of this frame are recorded in front of its draw work
+        _recording = &lists[back];
+
+        if (!PumpEvents())
+        {
+            break;
+        }
+
+        running = update(lists[back]);
+
+        // Waits until the render thread executed and presented the previous
+        // frame, after which the other list is free to record into
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&] () { return submitted == nullptr; });
+            submitted = &lists[back];
+        }
+        condition.notify_all();
+
+        back = 1 - back;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    renderThread.join();
+
+    _recording = nullptr;
+
+    MakeCurrent();
+
+    Shutdown();
+
+    return 0;
+}
+
+static bool HasExtension(const char *extensions, const char *name)
+{
+    if (extensions == nullptr)
+    {
+        return false;
+    }
+
+    auto length = strlen(name);
+    for (auto found = strstr(extensions, name); found != nullptr; found = strstr(found + length, name))
+    {
+        if ((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0'))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
 
 #ifdef _WIN32
 
 #include <GL/wglext.h>
 #include <windows.h>
 
-Application::~Application() {}
-
 typedef HGLRC (WINAPI * PFNGLXCREATECONTEXTATTRIBS) (HDC hDC, HGLRC hShareContext, const int *attribList);
 
 class Win32Application : public Application
 {
-    std::function<void(int width, int height)> _resize;
-    std::function<void()> _destroy;
     HINSTANCE _hInstance;
     HWND _hWnd;
     HDC _hDC;
@@ -42,9 +315,16 @@ class Win32Application : public Application
     LRESULT CALLBACK objectProc(UINT uMsg, WPARAM wParam, LPARAM lParam);
     static LRESULT CALLBACK staticProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
+protected:
+    virtual bool PumpEvents();
+    virtual void Present();
+    virtual void Shutdown();
+    virtual void MakeCurrent();
+    virtual void DoneCurrent();
+
 public:
     bool Startup(std::function<bool()> intialize, std::function<void(int width, int height)> resize, std::function<void()> destroy);
-    virtual int Run(std::function<bool()> tick);
+    virtual bool SetSwapInterval(int interval);
 
 };
 
@@ -180,39 +460,63 @@ bool Win32Application::Startup(std::function<bool()> intialize, std::function<vo
     return true;
 }
 
-int Win32Application::Run(std::function<bool()> tick)
+bool Win32Application::PumpEvents()
 {
-    bool running = true;
-
-    while (running)
+    MSG msg;
+    while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
     {
-        MSG msg;
-        while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+        if (msg.message == WM_QUIT)
         {
-            if (msg.message == WM_QUIT)
-            {
-                break;
-            }
-            else
-            {
-                TranslateMessage(&msg);
-                DispatchMessage(&msg);
-            }
+            return false;
         }
-        
-        if (IsWindowVisible(_hWnd) == FALSE)
+        else
         {
-            break;
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
         }
-        
-        running = tick();
-        
-        SwapBuffers(_hDC);
     }
-    
+
+    return IsWindowVisible(_hWnd) != FALSE;
+}
+
+void Win32Application::Present()
+{
+    SwapBuffers(_hDC);
+}
+
+void Win32Application::Shutdown()
+{
     _destroy();
-    
-    return 0;
+}
+
+void Win32Application::MakeCurrent()
+{
+    wglMakeCurrent(_hDC, _hRC);
+}
+
+void Win32Application::DoneCurrent()
+{
+    wglMakeCurrent(nullptr, nullptr);
+}
+
+bool Win32Application::SetSwapInterval(int interval)
+{
+    auto swapInterval = (PFNWGLSWAPINTERVALEXTPROC)wglGetProcAddress("wglSwapIntervalEXT");
+    if (swapInterval == nullptr)
+    {
+        return false;
+    }
+
+    if (interval < 0)
+    {
+        auto getExtensions = (PFNWGLGETEXTENSIONSSTRINGEXTPROC)wglGetProcAddress("wglGetExtensionsStringEXT");
+        if (getExtensions == nullptr || !HasExtension(getExtensions(), "WGL_EXT_swap_control_tear"))
+        {
+            return false;
+        }
+    }
+
+    return swapInterval(interval) == TRUE;
 }
 
 void Win32Application::Destroy(const char *errorMessage)
@@ -248,7 +552,7 @@ LRESULT CALLBACK Win32Application::objectProc(UINT uMsg, WPARAM wParam, LPARAM l
             auto width = LOWORD(lParam);
             auto height = HIWORD(lParam);
             
-            this->_resize(width, height);
+            this->Resized(width, height);
             
             break;
         }
@@ -304,6 +608,702 @@ Application *Application::Create(std::function<bool()> initialize, std::function
 #endif // _WIN32
 
 #ifdef __linux__
+
+#ifdef APPLICATION_HEADLESS
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#ifndef APPLICATION_HEADLESS_WIDTH
+#define APPLICATION_HEADLESS_WIDTH 1280
+#endif
+
+#ifndef APPLICATION_HEADLESS_HEIGHT
+#define APPLICATION_HEADLESS_HEIGHT 720
+#endif
+
+// Headless application on top of EGL. A pbuffer surface is used when the
+// display supports one, otherwise the context is made current without a
+// surface and an offscreen framebuffer stands in for the default one.
+class EglApplication : public Application
+{
+    EGLDisplay _display;
+    EGLSurface _surface;
+    EGLContext _context;
+    GLuint _framebufferId;
+    GLuint _renderbufferIds[2];
+    int _width;
+    int _height;
+
+    virtual void Destroy(const char *errorMessage = nullptr);
+
+    EGLDisplay OpenDisplay();
+    bool SetupFramebuffer();
+
+protected:
+    virtual bool PumpEvents();
+    virtual void Present();
+    virtual void Shutdown();
+    virtual void MakeCurrent();
+    virtual void DoneCurrent();
+
+public:
+    EglApplication();
+
+    bool Startup(std::function<bool()> intialize, std::function<void(int width, int height)> resize, std::function<void()> destroy);
+    virtual bool SetSwapInterval(int interval);
+
+};
+
+EglApplication::EglApplication()
+    : _display(EGL_NO_DISPLAY), _surface(EGL_NO_SURFACE), _context(EGL_NO_CONTEXT),
+      _framebufferId(0), _renderbufferIds{0, 0},
+      _width(APPLICATION_HEADLESS_WIDTH), _height(APPLICATION_HEADLESS_HEIGHT)
+{ }
+
+EGLDisplay EglApplication::OpenDisplay()
+{
+    auto clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay == nullptr)
+    {
+        return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    // Prefer a real GPU device, this does not need a running X server
+    if (HasExtension(clientExtensions, "EGL_EXT_platform_device"))
+    {
+        auto queryDevices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+        EGLDeviceEXT device;
+        EGLint deviceCount = 0;
+
+        if (queryDevices != nullptr && queryDevices(1, &device, &deviceCount) && deviceCount > 0)
+        {
+            auto display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+            if (display != EGL_NO_DISPLAY)
+            {
+                return display;
+            }
+        }
+    }
+
+    // Mesa (llvmpipe included) exposes a surfaceless platform without any window system
+    if (HasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+    {
+        auto display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display != EGL_NO_DISPLAY)
+        {
+            return display;
+        }
+    }
+
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool EglApplication::Startup(std::function<bool()> intialize, std::function<void(int width, int height)> resize, std::function<void()> destroy)
+{
+    _resize = resize;
+    _destroy = destroy;
+
+    _display = OpenDisplay();
+    if (_display == EGL_NO_DISPLAY)
+    {
+        Destroy("Failed to open EGL display");
+        return false;
+    }
+
+    if (eglInitialize(_display, nullptr, nullptr) == EGL_FALSE)
+    {
+        Destroy("Failed to initialize EGL display");
+        return false;
+    }
+
+    if (eglBindAPI(EGL_OPENGL_API) == EGL_FALSE)
+    {
+        Destroy("Failed to bind the OpenGL api");
+        return false;
+    }
+
+    EGLint pbufferConfigAttribs[] =
+    {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 16,
+        EGL_NONE
+    };
+
+    EGLint surfacelessConfigAttribs[] =
+    {
+        EGL_SURFACE_TYPE, 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+
+    EGLConfig config = nullptr;
+    EGLint configCount = 0;
+    bool surfaceless = false;
+
+    if (eglChooseConfig(_display, pbufferConfigAttribs, &config, 1, &configCount) == EGL_FALSE || configCount == 0)
+    {
+        if (!HasExtension(eglQueryString(_display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context"))
+        {
+            Destroy("Failed to choose a pbuffer config and surfaceless contexts are not supported");
+            return false;
+        }
+
+        if (eglChooseConfig(_display, surfacelessConfigAttribs, &config, 1, &configCount) == EGL_FALSE || configCount == 0)
+        {
+            Destroy("Failed to choose a surfaceless config");
+            return false;
+        }
+
+        surfaceless = true;
+    }
+
+    if (!surfaceless)
+    {
+        EGLint pbufferAttribs[] =
+        {
+            EGL_WIDTH, _width,
+            EGL_HEIGHT, _height,
+            EGL_NONE
+        };
+
+        _surface = eglCreatePbufferSurface(_display, config, pbufferAttribs);
+        if (_surface == EGL_NO_SURFACE)
+        {
+            Destroy("Failed to create pbuffer surface");
+            return false;
+        }
+    }
+
+    EGLint contextAttribs[] =
+    {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+        EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE
+    };
+
+    _context = eglCreateContext(_display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (_context == EGL_NO_CONTEXT)
+    {
+        Destroy("Failed to create modern opengl context (v3.3)");
+        return false;
+    }
+
+    if (eglMakeCurrent(_display, _surface, _surface, _context) == EGL_FALSE)
+    {
+        Destroy("Failed to make opengl context current");
+        return false;
+    }
+
+    gladLoadGLLoader((GLADloadproc)eglGetProcAddress);
+
+    if (surfaceless && !SetupFramebuffer())
+    {
+        Destroy("Failed to create offscreen framebuffer");
+        return false;
+    }
+
+    if (!intialize())
+    {
+        Destroy("Initialize failed");
+        return false;
+    }
+
+    Resized(_width, _height);
+
+    return true;
+}
+
+bool EglApplication::SetupFramebuffer()
+{
+    glGenFramebuffers(1, &_framebufferId);
+    glGenRenderbuffers(2, _renderbufferIds);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, _renderbufferIds[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, _width, _height);
+    glBindRenderbuffer(GL_RENDERBUFFER, _renderbufferIds[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, _width, _height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    // Stays bound, the examples never bind a framebuffer themselves
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebufferId);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, _renderbufferIds[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _renderbufferIds[1]);
+
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+bool EglApplication::PumpEvents()
+{
+    return true;
+}
+
+void EglApplication::Present()
+{
+    if (_surface != EGL_NO_SURFACE)
+    {
+        eglSwapBuffers(_display, _surface);
+    }
+    else
+    {
+        glFlush();
+    }
+}
+
+void EglApplication::Shutdown()
+{
+    Destroy();
+}
+
+void EglApplication::MakeCurrent()
+{
+    eglMakeCurrent(_display, _surface, _surface, _context);
+}
+
+void EglApplication::DoneCurrent()
+{
+    eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+bool EglApplication::SetSwapInterval(int interval)
+{
+    // EGL has no adaptive vsync and a pbuffer never waits on a display anyway
+    if (interval < 0 || _surface == EGL_NO_SURFACE)
+    {
+        return false;
+    }
+
+    return eglSwapInterval(_display, interval) == EGL_TRUE;
+}
+
+void EglApplication::Destroy(const char *errorMessage)
+{
+    if (errorMessage != nullptr)
+    {
+        std::cout << errorMessage << std::endl;
+    }
+
+    _destroy();
+
+    if (_framebufferId != 0)
+    {
+        glDeleteFramebuffers(1, &_framebufferId);
+        glDeleteRenderbuffers(2, _renderbufferIds);
+        _framebufferId = 0;
+    }
+
+    if (_display == EGL_NO_DISPLAY)
+    {
+        return;
+    }
+
+    eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+    if (_context != EGL_NO_CONTEXT)
+    {
+        eglDestroyContext(_display, _context);
+        _context = EGL_NO_CONTEXT;
+    }
+
+    if (_surface != EGL_NO_SURFACE)
+    {
+        eglDestroySurface(_display, _surface);
+        _surface = EGL_NO_SURFACE;
+    }
+
+    eglTerminate(_display);
+    _display = EGL_NO_DISPLAY;
+}
+
+Application *Application::Create(std::function<bool()> initialize, std::function<void(int width, int height)> resize, std::function<void()> destroy)
+{
+    static EglApplication app;
+
+    if (app.Startup(initialize, resize, destroy))
+    {
+        return &app;
+    }
+
+    std::cout << "Create application failed" << std::endl;
+
+    exit(0);
+
+    return nullptr;
+}
+
+#else // APPLICATION_HEADLESS
+
+#include <GL/glx.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+// Windowed application on top of X11 and GLX
+class GlxApplication : public Application
+{
+    Display *_display;
+    Window _window;
+    // Set by PumpEvents() when the window was destroyed, while the render thread
+    // of RunThreaded() can still be presenting to it
+    std::atomic<bool> _windowDestroyed;
+    Colormap _colormap;
+    Atom _deleteWindowAtom;
+    GLXContext _context;
+    PFNGLXCREATECONTEXTATTRIBSARBPROC _pfnGlxCreateContext;
+    int _width;
+    int _height;
+
+    virtual void Destroy(const char *errorMessage = nullptr);
+
+    static bool _contextError;
+    static int contextErrorHandler(Display *display, XErrorEvent *event);
+
+protected:
+    virtual bool PumpEvents();
+    virtual void Present();
+    virtual void Shutdown();
+    virtual void MakeCurrent();
+    virtual void DoneCurrent();
+
+public:
+    GlxApplication();
+
+    bool Startup(std::function<bool()> intialize, std::function<void(int width, int height)> resize, std::function<void()> destroy);
+    virtual bool SetSwapInterval(int interval);
+
+};
+
+bool GlxApplication::_contextError = false;
+
+GlxApplication::GlxApplication()
+    : _display(nullptr), _window(0), _windowDestroyed(false), _colormap(0), _deleteWindowAtom(0), _context(nullptr),
+      _pfnGlxCreateContext(nullptr), _width(0), _height(0)
+{ }
+
+int GlxApplication::contextErrorHandler(Display * /*display*/, XErrorEvent * /*event*/)
+{
+    _contextError = true;
+
+    return 0;
+}
+
+bool GlxApplication::Startup(std::function<bool()> intialize, std::function<void(int width, int height)> resize, std::function<void()> destroy)
+{
+    _resize = resize;
+    _destroy = destroy;
+
+    // The render thread of RunThreaded() swaps while this thread handles events
+    XInitThreads();
+
+    _display = XOpenDisplay(nullptr);
+    if (_display == nullptr)
+    {
+        Destroy("Failed to open X display");
+        return false;
+    }
+
+    int glxMajor = 0, glxMinor = 0;
+    if (glXQueryVersion(_display, &glxMajor, &glxMinor) == False || (glxMajor == 1 && glxMinor < 3) || glxMajor < 1)
+    {
+        Destroy("GLX 1.3 or newer is required");
+        return false;
+    }
+
+    static int const configAttribs[] =
+    {
+        GLX_X_RENDERABLE, True,
+        GLX_DRAWABLE_TYPE, GLX_WINDOW_BIT,
+        GLX_RENDER_TYPE, GLX_RGBA_BIT,
+        GLX_X_VISUAL_TYPE, GLX_TRUE_COLOR,
+        GLX_RED_SIZE, 8,
+        GLX_GREEN_SIZE, 8,
+        GLX_BLUE_SIZE, 8,
+        GLX_DEPTH_SIZE, 16,
+        GLX_DOUBLEBUFFER, True,
+        None
+    };
+
+    auto screen = DefaultScreen(_display);
+    int configCount = 0;
+    auto configs = glXChooseFBConfig(_display, screen, configAttribs, &configCount);
+    if (configs == nullptr || configCount == 0)
+    {
+        Destroy("Failed to choose framebuffer config");
+        return false;
+    }
+
+    auto config = configs[0];
+    XFree(configs);
+
+    auto visual = glXGetVisualFromFBConfig(_display, config);
+    if (visual == nullptr)
+    {
+        Destroy("Failed to get visual from framebuffer config");
+        return false;
+    }
+
+    auto root = RootWindow(_display, screen);
+    _colormap = XCreateColormap(_display, root, visual->visual, AllocNone);
+
+    XSetWindowAttributes windowAttribs;
+    windowAttribs.colormap = _colormap;
+    windowAttribs.background_pixmap = None;
+    windowAttribs.border_pixel = 0;
+    windowAttribs.event_mask = StructureNotifyMask | ExposureMask | KeyPressMask;
+
+    _width = DisplayWidth(_display, screen) / 2;
+    _height = DisplayHeight(_display, screen) / 2;
+
+    _window = XCreateWindow(
+        _display, root,
+        0, 0, _width, _height,
+        0, visual->depth, InputOutput, visual->visual,
+        CWBorderPixel | CWColormap | CWEventMask, &windowAttribs);
+
+    XFree(visual);
+
+    if (_window == 0)
+    {
+        Destroy("Failed to create window");
+        return false;
+    }
+
+    XStoreName(_display, _window, EXAMPLE_NAME);
+
+    _deleteWindowAtom = XInternAtom(_display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(_display, _window, &_deleteWindowAtom, 1);
+
+    _pfnGlxCreateContext = (PFNGLXCREATECONTEXTATTRIBSARBPROC)glXGetProcAddressARB((const GLubyte *)"glXCreateContextAttribsARB");
+    if (_pfnGlxCreateContext == nullptr || !HasExtension(glXQueryExtensionsString(_display, screen), "GLX_ARB_create_context"))
+    {
+        _context = glXCreateNewContext(_display, config, GLX_RGBA_TYPE, nullptr, True);
+
+        if (_context == nullptr)
+        {
+            Destroy("Failed to create clasic opengl context");
+            return false;
+        }
+    }
+    else
+    {
+        int attribList[] =
+        {
+            GLX_CONTEXT_MAJOR_VERSION_ARB, 3,
+            GLX_CONTEXT_MINOR_VERSION_ARB, 3,
+            GLX_CONTEXT_PROFILE_MASK_ARB, GLX_CONTEXT_CORE_PROFILE_BIT_ARB,
+            None
+        };
+
+        // A driver without 3.3 support reports this through an X error
+        _contextError = false;
+        auto oldHandler = XSetErrorHandler(&GlxApplication::contextErrorHandler);
+        _context = _pfnGlxCreateContext(_display, config, nullptr, True, attribList);
+        XSync(_display, False);
+        XSetErrorHandler(oldHandler);
+
+        if (_context == nullptr || _contextError)
+        {
+            Destroy("Failed to create modern opengl context (v3.3)");
+            return false;
+        }
+    }
+
+    glXMakeCurrent(_display, _window, _context);
+
+    gladLoadGL();
+
+    if (!intialize())
+    {
+        Destroy("Initialize failed");
+        return false;
+    }
+
+    // ConfigureNotify only reports sizes that differ from the requested one,
+    // so without a window manager that resizes the window it never comes
+    Resized(_width, _height);
+
+    XMapRaised(_display, _window);
+    XFlush(_display);
+
+    return true;
+}
+
+bool GlxApplication::PumpEvents()
+{
+    // XPending never blocks, so the frame is not held up by an empty queue
+    while (XPending(_display) > 0)
+    {
+        XEvent event;
+        XNextEvent(_display, &event);
+
+        switch (event.type)
+        {
+            case ConfigureNotify:
+            {
+                if (event.xconfigure.width != _width || event.xconfigure.height != _height)
+                {
+                    _width = event.xconfigure.width;
+                    _height = event.xconfigure.height;
+
+                    Resized(_width, _height);
+                }
+                break;
+            }
+            case ClientMessage:
+            {
+                if (Atom(event.xclient.data.l[0]) == _deleteWindowAtom)
+                {
+                    return false;
+                }
+                break;
+            }
+            case DestroyNotify:
+            {
+                // The window is gone already, Destroy() must not destroy it again
+                _windowDestroyed = true;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void GlxApplication::Present()
+{
+    if (!_windowDestroyed)
+    {
+        glXSwapBuffers(_display, _window);
+    }
+}
+
+void GlxApplication::Shutdown()
+{
+    Destroy();
+}
+
+void GlxApplication::MakeCurrent()
+{
+    glXMakeCurrent(_display, _window, _context);
+}
+
+void GlxApplication::DoneCurrent()
+{
+    glXMakeCurrent(_display, None, nullptr);
+}
+
+bool GlxApplication::SetSwapInterval(int interval)
+{
+    auto extensions = glXQueryExtensionsString(_display, DefaultScreen(_display));
+
+    if (interval < 0 && !HasExtension(extensions, "GLX_EXT_swap_control_tear"))
+    {
+        return false;
+    }
+
+    if (HasExtension(extensions, "GLX_EXT_swap_control"))
+    {
+        auto swapInterval = (PFNGLXSWAPINTERVALEXTPROC)glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalEXT");
+        if (swapInterval != nullptr)
+        {
+            swapInterval(_display, _window, interval);
+
+            return true;
+        }
+    }
+
+    // The older extensions can not express adaptive vsync
+    if (interval < 0)
+    {
+        return false;
+    }
+
+    if (HasExtension(extensions, "GLX_MESA_swap_control"))
+    {
+        auto swapInterval = (PFNGLXSWAPINTERVALMESAPROC)glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalMESA");
+        if (swapInterval != nullptr)
+        {
+            return swapInterval(unsigned(interval)) == 0;
+        }
+    }
+
+    // GLX_SGI_swap_control can not turn vsync off
+    if (interval > 0 && HasExtension(extensions, "GLX_SGI_swap_control"))
+    {
+        auto swapInterval = (PFNGLXSWAPINTERVALSGIPROC)glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalSGI");
+        if (swapInterval != nullptr)
+        {
+            return swapInterval(interval) == 0;
+        }
+    }
+
+    return false;
+}
+
+void GlxApplication::Destroy(const char *errorMessage)
+{
+    if (errorMessage != nullptr)
+    {
+        std::cout << errorMessage << std::endl;
+    }
+
+    _destroy();
+
+    if (_display == nullptr)
+    {
+        return;
+    }
+
+    if (_context != nullptr)
+    {
+        glXMakeCurrent(_display, None, nullptr);
+        glXDestroyContext(_display, _context);
+        _context = nullptr;
+    }
+
+    if (_window != 0)
+    {
+        if (!_windowDestroyed)
+        {
+            XDestroyWindow(_display, _window);
+        }
+        _window = 0;
+    }
+
+    if (_colormap != 0)
+    {
+        XFreeColormap(_display, _colormap);
+        _colormap = 0;
+    }
+
+    XCloseDisplay(_display);
+    _display = nullptr;
+}
+
+Application *Application::Create(std::function<bool()> initialize, std::function<void(int width, int height)> resize, std::function<void()> destroy)
+{
+    static GlxApplication app;
+
+    if (app.Startup(initialize, resize, destroy))
+    {
+        return &app;
+    }
+
+    std::cout << "Create application failed" << std::endl;
+
+    exit(0);
+
+    return nullptr;
+}
+
+#endif // APPLICATION_HEADLESS
+
 #endif // __linux__
 
 #endif // APPLICATION_IMPLEMENTATION
\ No newline at end of file
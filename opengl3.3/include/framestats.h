@@ -0,0 +1,234 @@
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include "glad/glad.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Percentiles over the most recent frames, all values in milliseconds
+struct FrameTimings
+{
+    float p50;
+    float p95;
+    float p99;
+    float max;
+    size_t samples;
+};
+
+// Collects per-frame CPU timings, and optionally GPU timings, into a ring of
+// the last Capacity frames. Only the render loop writes; any other thread may
+// read Timings() at any time without taking a lock.
+class FrameStats
+{
+public:
+    enum Metric
+    {
+        Tick,       // time spent in the tick() callback
+        Present,    // time spent swapping buffers
+        Frame,      // time between the end of two consecutive frames
+        Gpu,        // GPU time of the commands issued by tick()
+        MetricCount
+    };
+
+    static const size_t Capacity = 1024;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // GPU results are read this many frames late so the query never stalls
+    static const int QueryLatency = 4;
+
+    struct Ring
+    {
+        std::atomic<float> values[Capacity];
+        std::atomic<size_t> written;
+
+        Ring() : written(0) { }
+
+        void push(float value)
+        {
+            auto index = written.load(std::memory_order_relaxed);
+            values[index % Capacity].store(value, std::memory_order_relaxed);
+            written.store(index + 1, std::memory_order_release);
+        }
+    };
+
+    Ring _rings[MetricCount];
+
+    Clock::time_point _frameStart;
+    Clock::time_point _tickEnd;
+    Clock::time_point _lastFrameEnd;
+    bool _hasLastFrame;
+
+    // Set by any thread, read by the thread that renders
+    std::atomic<bool> _gpuTiming;
+    GLuint _queryIds[QueryLatency];
+    bool _queryPending[QueryLatency];
+    int _queryIndex;
+    bool _queryActive;
+
+    // llvmpipe reports a time of hours for the first GL_TIME_ELAPSED query of
+    // a context, later queries are fine
+    bool _skipFirstQuery;
+
+    static float milliseconds(Clock::duration duration)
+    {
+        return std::chrono::duration<float, std::milli>(duration).count();
+    }
+
+    // Reads the finished queries oldest first, so the GPU times are pushed in
+    // the order of their frames. The slot the next query goes into is the
+    // oldest one, and a query never finishes before an older one.
+    void collectQueries()
+    {
+        for (int i = 0; i < QueryLatency; i++)
+        {
+            auto slot = (_queryIndex + i) % QueryLatency;
+            if (!_queryPending[slot])
+            {
+                continue;
+            }
+
+            GLint available = GL_FALSE;
+            glGetQueryObjectiv(_queryIds[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available == GL_FALSE)
+            {
+                break;
+            }
+
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(_queryIds[slot], GL_QUERY_RESULT, &elapsed);
+            _queryPending[slot] = false;
+
+            if (_skipFirstQuery)
+            {
+                _skipFirstQuery = false;
+                continue;
+            }
+
+            _rings[Gpu].push(float(double(elapsed) / 1000000.0));
+        }
+    }
+
+public:
+    FrameStats()
+        : _hasLastFrame(false), _gpuTiming(false), _queryIds(), _queryPending(), _queryIndex(0), _queryActive(false), _skipFirstQuery(false)
+    { }
+
+    // Can be called from any thread, the thread that renders creates the queries
+    // on its next frame
+    void EnableGpuTiming(bool enable)
+    {
+        _gpuTiming = enable;
+    }
+
+    void BeginFrame()
+    {
+        _frameStart = Clock::now();
+
+        if (!_gpuTiming)
+        {
+            // Keeps what finished before timing was turned off and drops the
+            // rest, so turning it on again does not mix in old frames
+            if (_queryIds[0] != 0)
+            {
+                collectQueries();
+                std::fill(_queryPending, _queryPending + QueryLatency, false);
+            }
+            return;
+        }
+
+        if (_queryIds[0] == 0)
+        {
+            glGenQueries(QueryLatency, _queryIds);
+
+            auto renderer = reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+            _skipFirstQuery = renderer != nullptr && std::strstr(renderer, "llvmpipe") != nullptr;
+        }
+
+        collectQueries();
+
+        // When every query is still in flight this frame is not timed on the GPU
+        if (!_queryPending[_queryIndex])
+        {
+            glBeginQuery(GL_TIME_ELAPSED, _queryIds[_queryIndex]);
+            _queryActive = true;
+        }
+    }
+
+    void EndTick()
+    {
+        _tickEnd = Clock::now();
+
+        if (_queryActive)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            _queryActive = false;
+            _queryPending[_queryIndex] = true;
+            _queryIndex = (_queryIndex + 1) % QueryLatency;
+        }
+    }
+
+    void EndFrame()
+    {
+        auto frameEnd = Clock::now();
+
+        _rings[Tick].push(milliseconds(_tickEnd - _frameStart));
+        _rings[Present].push(milliseconds(frameEnd - _tickEnd));
+        _rings[Frame].push(milliseconds(frameEnd - (_hasLastFrame ? _lastFrameEnd : _frameStart)));
+
+        _lastFrameEnd = frameEnd;
+        _hasLastFrame = true;
+    }
+
+    // Deletes the GPU queries, call while the GL context is still current
+    void Release()
+    {
+        if (_queryIds[0] != 0)
+        {
+            glDeleteQueries(QueryLatency, _queryIds);
+            std::fill(_queryIds, _queryIds + QueryLatency, 0);
+            std::fill(_queryPending, _queryPending + QueryLatency, false);
+        }
+    }
+
+    FrameTimings Timings(Metric metric) const
+    {
+        auto const &ring = _rings[metric];
+        auto written = ring.written.load(std::memory_order_acquire);
+        auto count = written < Capacity ? written : Capacity;
+
+        std::vector<float> values(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            values[i] = ring.values[(written - count + i) % Capacity].load(std::memory_order_relaxed);
+        }
+
+        FrameTimings timings = { 0.0f, 0.0f, 0.0f, 0.0f, count };
+        if (count == 0)
+        {
+            return timings;
+        }
+
+        std::sort(values.begin(), values.end());
+
+        // Nearest-rank percentile
+        auto percentile = [&values, count] (float p) {
+            auto rank = size_t(std::ceil(p * float(count)));
+            return values[std::max(rank, size_t(1)) - 1];
+        };
+
+        timings.p50 = percentile(0.50f);
+        timings.p95 = percentile(0.95f);
+        timings.p99 = percentile(0.99f);
+        timings.max = values.back();
+
+        return timings;
+    }
+};
+
+#endif // FRAMESTATS_H
@@ -0,0 +1,109 @@
+#ifndef GLBATCH_H
+#define GLBATCH_H
+
+#include "glad/glad.h"
+#include "glbuffer.h"
+#include "glmath.h"
+#include "glshader.h"
+#include "glstate.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Counts of one flush, to see how much state the sorting saved
+struct BatchStats
+{
+    size_t draws;
+    size_t programChanges;
+    size_t vertexArrayChanges;
+};
+
+// Collects the draws of a frame and submits them sorted by program, vertex
+// array and draw mode, so each program is selected and each vertex array is
+// bound only once per run of draws that share it. The shaders and buffers
+// must stay alive until flush().
+class BatchRenderer
+{
+    struct Draw
+    {
+        uint64_t key;
+        ShaderType const *shader;
+        BufferType *buffer;
+        glm::mat4 matrix;
+        GLenum mode;
+    };
+
+    std::vector<Draw> _draws;
+    BatchStats _stats;
+
+    // 24 bits of program, 24 bits of vertex array and 16 bits of draw mode,
+    // most expensive state change in the highest bits
+    static uint64_t makeKey(GLuint program, GLuint vertexArray, GLenum mode)
+    {
+        return (uint64_t(program & 0xffffff) << 40) | (uint64_t(vertexArray & 0xffffff) << 16) | uint64_t(mode & 0xffff);
+    }
+
+public:
+    BatchRenderer()
+        : _stats({ 0, 0, 0 })
+    { }
+
+    virtual ~BatchRenderer() { }
+
+    // Matrix is the one that would be passed to ShaderType::setupMatrices(),
+    // the buffer is drawn with the mode it was set up with
+    void submit(ShaderType const &shader, BufferType &buffer, glm::mat4 const &matrix)
+    {
+        submit(shader, buffer, matrix, buffer.drawMode());
+    }
+
+    // Draws the buffer with another primitive mode, like GL_LINE_LOOP for an outline
+    void submit(ShaderType const &shader, BufferType &buffer, glm::mat4 const &matrix, GLenum mode)
+    {
+        _draws.push_back(Draw({ makeKey(shader.id(), buffer.vertexArrayId(), mode), &shader, &buffer, matrix, mode }));
+    }
+
+    // Draws everything submitted since the last flush
+    BatchStats const &flush()
+    {
+        _stats = { _draws.size(), 0, 0 };
+
+        // Stable, so draws with the same state keep the order they were submitted in
+        std::stable_sort(_draws.begin(), _draws.end(), [] (Draw const &a, Draw const &b) {
+            return a.key < b.key;
+        });
+
+        GLuint program = 0;
+        GLuint vertexArray = 0;
+        for (auto &draw : _draws)
+        {
+            if (draw.shader->id() != program)
+            {
+                program = draw.shader->id();
+                draw.shader->use();
+                _stats.programChanges++;
+            }
+
+            if (draw.buffer->vertexArrayId() != vertexArray)
+            {
+                vertexArray = draw.buffer->vertexArrayId();
+                stateCache().bindVertexArray(vertexArray);
+                _stats.vertexArrayChanges++;
+            }
+
+            draw.shader->setMatrix(draw.matrix);
+            draw.buffer->draw(draw.mode);
+        }
+
+        _draws.clear();
+
+        return _stats;
+    }
+
+    BatchStats const &stats() const
+    {
+        return _stats;
+    }
+};
+
+#endif // GLBATCH_H
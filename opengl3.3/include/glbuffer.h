@@ -3,7 +3,13 @@
 
 #include "glad/glad.h"
 #include "glmath.h"
-#include <map>
+#include "glshader.h"
+#include "glstate.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
 #include <vector>
 
 class VertexType
@@ -13,32 +19,527 @@ public:
     glm::vec4 col;
 };
 
+// vec4 is 16 byte aligned, so there is padding between pos and col
+struct VertexTypeLayout : VertexLayout<VertexType,
+    VertexAttrib<decltype(VertexType::pos), offsetof(VertexType, pos)>,
+    VertexAttrib<decltype(VertexType::col), offsetof(VertexType, col)>>
+{
+    // Inputs of the default shader
+    static char const *name(size_t index)
+    {
+        static char const *const names[] = { "vertex", "color" };
+
+        return names[index];
+    }
+};
+
+// Per-instance data of the default instanced shader
+class InstanceType
+{
+public:
+    glm::mat4 model;
+    glm::vec4 tint;
+};
+
+struct InstanceTypeLayout : VertexLayout<InstanceType,
+    VertexAttrib<decltype(InstanceType::model), offsetof(InstanceType, model)>,
+    VertexAttrib<decltype(InstanceType::tint), offsetof(InstanceType, tint)>>
+{
+    static const GLuint divisor = 1;
+
+    static char const *name(size_t index)
+    {
+        static char const *const names[] = { "model", "tint" };
+
+        return names[index];
+    }
+};
+
 class BufferType
 {
+public:
+    // Storage of the attributes on the GPU, the vertices are always built as
+    // VertexType and converted when they are uploaded
+    enum PositionFormat
+    {
+        PositionFloat,      // 3 floats
+        PositionHalfFloat,  // 3 half floats, exact for integers up to 2048
+        PositionPacked,     // 10 bits per axis within the bounds of the mesh, see dequantizeMatrix()
+    };
+
+    enum ColorFormat
+    {
+        ColorFloat,         // 4 floats
+        ColorUnsignedByte,  // 4 normalized bytes
+    };
+
+    // Interleaved storage keeps whole vertices together, separate storage keeps
+    // a stream of positions and a stream of colors, in memory and in two GL
+    // buffers. Passes that only read positions then only fetch positions.
+    enum Storage
+    {
+        StorageInterleaved,
+        StorageSeparate,
+    };
+
+private:
     int _vertexCount;
+    int _indexCount;
     std::vector<VertexType> _verts;
+    std::vector<glm::vec3> _positions;
+    std::vector<glm::vec4> _colors;
+    std::vector<unsigned int> _indices;
     glm::vec4 _nextColor;
     unsigned int _vertexArrayId;
     unsigned int _vertexBufferId;
+    unsigned int _colorBufferId;
+    unsigned int _indexBufferId;
+    unsigned int _indirectBufferId;
+    unsigned int _instanceBufferId;
     GLenum _drawMode;
-    std::map<int, int> _faces;
+    GLenum _usage;
+    GLenum _indexType;
+    bool _indexed;
+    bool _indirect;
+    bool _facesDirty;
+    PositionFormat _positionFormat;
+    ColorFormat _colorFormat;
+    Storage _storage;
+    glm::mat4 _dequantize;
+
+    // Faces as flat arrays, so all of them are submitted with one multi draw call
+    std::vector<GLint> _faceFirsts;
+    std::vector<GLsizei> _faceCounts;
+    std::vector<const GLvoid*> _faceOffsets;
+
+    // Hashes and compares the components only, VertexType has padding bytes
+    struct VertexHash
+    {
+        size_t operator () (VertexType const &v) const
+        {
+            float const components[] = { v.pos.x, v.pos.y, v.pos.z, v.col.r, v.col.g, v.col.b, v.col.a };
+
+            size_t hash = 14695981039346656037ull;
+            for (auto component : components)
+            {
+                unsigned int bits;
+                memcpy(&bits, &component, sizeof(bits));
+                hash = (hash ^ bits) * 1099511628211ull;
+            }
+
+            return hash;
+        }
+    };
+
+    struct VertexEqual
+    {
+        bool operator () (VertexType const &a, VertexType const &b) const
+        {
+            return a.pos.x == b.pos.x && a.pos.y == b.pos.y && a.pos.z == b.pos.z
+                && a.col.r == b.col.r && a.col.g == b.col.g && a.col.b == b.col.b && a.col.a == b.col.a;
+        }
+    };
+
+    void addVertex(VertexType const &vertex)
+    {
+        if (_storage == StorageSeparate)
+        {
+            _positions.push_back(vertex.pos);
+            _colors.push_back(vertex.col);
+            _vertexCount = _positions.size();
+        }
+        else
+        {
+            _verts.push_back(vertex);
+            _vertexCount = _verts.size();
+        }
+    }
+
+    size_t storedCount() const
+    {
+        return _storage == StorageSeparate ? _positions.size() : _verts.size();
+    }
+
+    glm::vec3 const &positionAt(size_t i) const
+    {
+        return _storage == StorageSeparate ? _positions[i] : _verts[i].pos;
+    }
+
+    glm::vec4 const &colorAt(size_t i) const
+    {
+        return _storage == StorageSeparate ? _colors[i] : _verts[i].col;
+    }
+
+    // Replaces the vertices by the unique ones and fills _indices to draw them in the original order
+    void deduplicate()
+    {
+        if (_storage == StorageSeparate)
+        {
+            // Deduplicate whole vertices, then split them into streams again
+            _verts.clear();
+            _verts.reserve(_positions.size());
+            for (size_t i = 0; i < _positions.size(); i++)
+            {
+                _verts.push_back(VertexType({ _positions[i], _colors[i] }));
+            }
+        }
+
+        std::unordered_map<VertexType, unsigned int, VertexHash, VertexEqual> unique;
+        unique.reserve(_verts.size());
+
+        std::vector<VertexType> verts;
+        verts.reserve(_verts.size());
+
+        _indices.clear();
+        _indices.reserve(_verts.size());
+
+        for (auto const &vertex : _verts)
+        {
+            auto found = unique.insert(std::make_pair(vertex, static_cast<unsigned int>(verts.size())));
+            if (found.second)
+            {
+                verts.push_back(vertex);
+            }
+            _indices.push_back(found.first->second);
+        }
+
+        _verts.swap(verts);
+
+        if (_storage == StorageSeparate)
+        {
+            _positions.clear();
+            _colors.clear();
+            for (auto const &vertex : _verts)
+            {
+                _positions.push_back(vertex.pos);
+                _colors.push_back(vertex.col);
+            }
+            _verts.clear();
+        }
+    }
+
+    size_t indexSize() const
+    {
+        return _indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+    }
+
+    // Expects the VAO to be bound, the element buffer binding is part of its state
+    void uploadIndices()
+    {
+        if (_indexBufferId == 0)
+        {
+            glGenBuffers(1, &_indexBufferId);
+        }
+        stateCache().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBufferId);
+
+        if (_vertexCount <= 0x10000)
+        {
+            _indexType = GL_UNSIGNED_SHORT;
+
+            std::vector<unsigned short> shortIndices(_indices.begin(), _indices.end());
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(shortIndices.size() * sizeof(unsigned short)), shortIndices.data(), _usage);
+        }
+        else
+        {
+            _indexType = GL_UNSIGNED_INT;
+
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(_indices.size() * sizeof(unsigned int)), _indices.data(), _usage);
+        }
+    }
+
+    // Bytes of one position and one color in their storage formats
+    size_t positionSize() const
+    {
+        switch (_positionFormat)
+        {
+            case PositionHalfFloat: return _storage == StorageSeparate ? 6 : 8; // padded to 4 bytes when interleaved
+            case PositionPacked: return 4;
+            default: return sizeof(glm::vec3);
+        }
+    }
+
+    size_t colorSize() const
+    {
+        return _colorFormat == ColorUnsignedByte ? 4 : sizeof(glm::vec4);
+    }
+
+    VertexFormat vertexFormat() const
+    {
+        if (_storage == StorageInterleaved && _positionFormat == PositionFloat && _colorFormat == ColorFloat)
+        {
+            return { VertexTypeLayout::stride, VertexTypeLayout::attributes()[0], VertexTypeLayout::attributes()[1] };
+        }
+
+        VertexFormat format;
+        switch (_positionFormat)
+        {
+            case PositionFloat: format.position = { 3, GL_FLOAT, GL_FALSE, 0 }; break;
+            case PositionHalfFloat: format.position = { 3, GL_HALF_FLOAT, GL_FALSE, 0 }; break;
+            case PositionPacked: format.position = { 4, GL_INT_2_10_10_10_REV, GL_FALSE, 0 }; break;
+        }
+        switch (_colorFormat)
+        {
+            case ColorFloat: format.color = { 4, GL_FLOAT, GL_FALSE, 0 }; break;
+            case ColorUnsignedByte: format.color = { 4, GL_UNSIGNED_BYTE, GL_TRUE, 0 }; break;
+        }
+
+        if (_storage == StorageSeparate)
+        {
+            // Both streams are tightly packed in their own buffer
+            format.stride = 0;
+        }
+        else
+        {
+            format.stride = GLsizei(positionSize() + colorSize());
+            format.color.offset = positionSize();
+        }
+
+        return format;
+    }
+
+    static unsigned char unorm8(float v)
+    {
+        return static_cast<unsigned char>(std::lround(std::min(std::max(v, 0.0f), 1.0f) * 255.0f));
+    }
+
+    void packPosition(unsigned char *out, glm::vec3 const &position, glm::vec3 const &center, glm::vec3 const &step) const
+    {
+        switch (_positionFormat)
+        {
+            case PositionFloat:
+            {
+                memcpy(out, position.data, sizeof(position.data));
+                break;
+            }
+            case PositionHalfFloat:
+            {
+                unsigned short const half[] = {
+                    glm::packHalf1x16(position.x), glm::packHalf1x16(position.y), glm::packHalf1x16(position.z), 0
+                };
+                memcpy(out, half, positionSize());
+                break;
+            }
+            case PositionPacked:
+            {
+                unsigned int packed = 1u << 30; // w = 1
+                for (int i = 0; i < 3; i++)
+                {
+                    auto q = std::lround((position[i] - center[i]) / step[i]);
+                    packed |= (unsigned(std::min(std::max(q, -511L), 511L)) & 0x3ffu) << (10 * i);
+                }
+                memcpy(out, &packed, sizeof(packed));
+                break;
+            }
+        }
+    }
+
+    void packColor(unsigned char *out, glm::vec4 const &color) const
+    {
+        switch (_colorFormat)
+        {
+            case ColorFloat:
+            {
+                memcpy(out, color.data, sizeof(color.data));
+                break;
+            }
+            case ColorUnsignedByte:
+            {
+                for (int i = 0; i < 4; i++)
+                {
+                    out[i] = unorm8(color[i]);
+                }
+                break;
+            }
+        }
+    }
+
+    // Converts the vertices into their storage formats, vertex i goes to
+    // positions + i * positionStride and colors + i * colorStride. Packed
+    // positions are stored as integers in -511..511 around the center of the
+    // mesh bounds, _dequantize scales them back.
+    void packVertices(unsigned char *positions, size_t positionStride, unsigned char *colors, size_t colorStride)
+    {
+        auto count = storedCount();
+
+        glm::vec3 center, step(1.0f);
+        if (_positionFormat == PositionPacked && count > 0)
+        {
+            glm::vec3 lo = positionAt(0), hi = positionAt(0);
+            for (size_t v = 0; v < count; v++)
+            {
+                for (int i = 0; i < 3; i++)
+                {
+                    lo[i] = std::min(lo[i], positionAt(v)[i]);
+                    hi[i] = std::max(hi[i], positionAt(v)[i]);
+                }
+            }
+            for (int i = 0; i < 3; i++)
+            {
+                center[i] = (lo[i] + hi[i]) * 0.5f;
+                step[i] = hi[i] > lo[i] ? (hi[i] - lo[i]) * 0.5f / 511.0f : 1.0f;
+            }
+        }
+        _dequantize = glm::translate(center) * glm::scale(step);
+
+        for (size_t v = 0; v < count; v++)
+        {
+            packPosition(positions + v * positionStride, positionAt(v), center, step);
+            packColor(colors + v * colorStride, colorAt(v));
+        }
+    }
+
+    static void uploadBuffer(unsigned int buffer, size_t size, void const *data, GLenum usage)
+    {
+        stateCache().bindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(size), data, usage);
+    }
+
+    // Leaves the last uploaded buffer bound
+    void uploadVertices()
+    {
+        auto compact = _positionFormat != PositionFloat || _colorFormat != ColorFloat;
+
+        if (_storage == StorageSeparate)
+        {
+            if (compact)
+            {
+                std::vector<unsigned char> positions(_positions.size() * positionSize());
+                std::vector<unsigned char> colors(_colors.size() * colorSize());
+                packVertices(positions.data(), positionSize(), colors.data(), colorSize());
+                uploadBuffer(_vertexBufferId, positions.size(), positions.data(), _usage);
+                uploadBuffer(_colorBufferId, colors.size(), colors.data(), _usage);
+            }
+            else
+            {
+                uploadBuffer(_vertexBufferId, _positions.size() * sizeof(glm::vec3), _positions.data(), _usage);
+                uploadBuffer(_colorBufferId, _colors.size() * sizeof(glm::vec4), _colors.data(), _usage);
+            }
+        }
+        else if (compact)
+        {
+            auto stride = positionSize() + colorSize();
+            std::vector<unsigned char> data(_verts.size() * stride);
+            packVertices(data.data(), stride, data.data() + positionSize(), stride);
+            uploadBuffer(_vertexBufferId, data.size(), data.data(), _usage);
+        }
+        else
+        {
+            uploadBuffer(_vertexBufferId, _verts.size() * sizeof(VertexType), _verts.data(), _usage);
+        }
+    }
+
+    void releaseVertices()
+    {
+        if (_usage == GL_STATIC_DRAW)
+        {
+            // Static buffers are never refilled, give the memory back
+            std::vector<VertexType>().swap(_verts);
+            std::vector<glm::vec3>().swap(_positions);
+            std::vector<glm::vec4>().swap(_colors);
+            std::vector<unsigned int>().swap(_indices);
+        }
+        else
+        {
+            _verts.clear();
+            _positions.clear();
+            _colors.clear();
+            _indices.clear();
+        }
+    }
+
+    // Layouts of the commands read by glMultiDraw*Indirect
+    struct DrawArraysIndirectCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint first;
+        GLuint baseInstance;
+    };
+
+    struct DrawElementsIndirectCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    // Byte offsets of the faces depend on the index type, so this runs again
+    // whenever the indices are uploaded, and before drawing faces added since
+    void setupFaces()
+    {
+        _facesDirty = false;
+
+        _faceOffsets.clear();
+        for (auto first : _faceFirsts)
+        {
+            _faceOffsets.push_back(reinterpret_cast<const GLvoid*>(first * indexSize()));
+        }
+
+        if (!_indirect || !GLAD_GL_ARB_multi_draw_indirect || _faceFirsts.empty())
+        {
+            return;
+        }
+
+        if (_indirectBufferId == 0)
+        {
+            glGenBuffers(1, &_indirectBufferId);
+        }
+        stateCache().bindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBufferId);
+
+        if (_indexed)
+        {
+            std::vector<DrawElementsIndirectCommand> commands;
+            for (size_t i = 0; i < _faceFirsts.size(); i++)
+            {
+                commands.push_back({ GLuint(_faceCounts[i]), 1, GLuint(_faceFirsts[i]), 0, 0 });
+            }
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, GLsizeiptr(commands.size() * sizeof(DrawElementsIndirectCommand)), commands.data(), GL_STATIC_DRAW);
+        }
+        else
+        {
+            std::vector<DrawArraysIndirectCommand> commands;
+            for (size_t i = 0; i < _faceFirsts.size(); i++)
+            {
+                commands.push_back({ GLuint(_faceCounts[i]), 1, GLuint(_faceFirsts[i]), 0 });
+            }
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, GLsizeiptr(commands.size() * sizeof(DrawArraysIndirectCommand)), commands.data(), GL_STATIC_DRAW);
+        }
+
+        stateCache().bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
 
 public:
     BufferType()
-        : _vertexCount(0), _vertexArrayId(0), _vertexBufferId(0), _drawMode(GL_TRIANGLES)
+        : _vertexCount(0), _indexCount(0), _vertexArrayId(0), _vertexBufferId(0), _colorBufferId(0), _indexBufferId(0), _indirectBufferId(0), _instanceBufferId(0),
+          _drawMode(GL_TRIANGLES), _usage(GL_STATIC_DRAW), _indexType(GL_UNSIGNED_INT), _indexed(false), _indirect(true), _facesDirty(false),
+          _positionFormat(PositionFloat), _colorFormat(ColorFloat), _storage(StorageInterleaved), _dequantize(1.0f)
     { }
 
     virtual ~BufferType() { }
 
+    // The vertices with interleaved storage
     std::vector<VertexType>& verts()
     {
         return _verts;
     }
 
+    // The streams with separate storage, the positions can be fed straight to
+    // glm::transform() and other loops over contiguous positions
+    std::vector<glm::vec3>& positions()
+    {
+        return _positions;
+    }
+
+    std::vector<glm::vec4>& colors()
+    {
+        return _colors;
+    }
+
     BufferType& operator << (VertexType const &vertex)
     {
-        _verts.push_back(vertex);
-        _vertexCount = _verts.size();
+        addVertex(vertex);
 
         return *this;
     }
@@ -48,9 +549,62 @@ public:
         _drawMode = mode;
     }
 
+    // GL_STATIC_DRAW by default, use GL_DYNAMIC_DRAW or GL_STREAM_DRAW for buffers
+    // that are refilled with update()
+    void setUsage(GLenum usage)
+    {
+        _usage = usage;
+    }
+
+    // Call before setup, the format can not change afterwards
+    void setFormat(PositionFormat positionFormat, ColorFormat colorFormat)
+    {
+        _positionFormat = positionFormat;
+        _colorFormat = colorFormat;
+    }
+
+    // Call before adding vertices
+    void setStorage(Storage storage)
+    {
+        _storage = storage;
+    }
+
+    // Model matrix that turns packed positions back into the positions they were
+    // built with, identity for the other formats. Multiply it into the matrix
+    // passed to ShaderType::setupMatrices(). Changes on setup() and update().
+    glm::mat4 const &dequantizeMatrix() const
+    {
+        return _dequantize;
+    }
+
+    // When indexed, the vertices added with vertex() are deduplicated on setup and
+    // drawn through an index buffer. Faces then refer to ranges of indices.
+    void setIndexed(bool indexed)
+    {
+        _indexed = indexed;
+    }
+
+    // Adds an explicit index, this makes the buffer indexed and skips deduplication
+    BufferType& index(unsigned int i)
+    {
+        _indices.push_back(i);
+        _indexed = true;
+
+        return *this;
+    }
+
+    // Faces are drawn from an indirect buffer when GL_ARB_multi_draw_indirect is
+    // available, unless this is turned off before setup
+    void setIndirect(bool indirect)
+    {
+        _indirect = indirect;
+    }
+
     void addFace(int start, int count)
     {
-        _faces.insert(std::make_pair(start, count));
+        _faceFirsts.push_back(start);
+        _faceCounts.push_back(count);
+        _facesDirty = true;
     }
 
     int vertexCount() const
@@ -58,12 +612,66 @@ public:
         return _vertexCount;
     }
 
-    BufferType& vertex(glm::vec3 const &position)
+    int indexCount() const
     {
-        _verts.push_back(VertexType({ position, _nextColor }));
+        return _indexCount;
+    }
 
+    // Size hint for the vertices that are going to be added, saves reallocating
+    // while a big mesh is built
+    void reserve(int vertexCount)
+    {
+        if (_storage == StorageSeparate)
+        {
+            _positions.reserve(size_t(vertexCount));
+            _colors.reserve(size_t(vertexCount));
+        }
+        else
+        {
+            _verts.reserve(size_t(vertexCount));
+        }
+    }
+
+    // Appends count vertices and returns them to be written in place, for meshes
+    // whose size is known up front. Only for interleaved storage.
+    VertexType* allocate(int count)
+    {
+        if (_storage == StorageSeparate)
+        {
+            return nullptr;
+        }
+
+        auto first = _verts.size();
+        _verts.resize(first + size_t(count));
         _vertexCount = _verts.size();
 
+        return _verts.data() + first;
+    }
+
+    // Same for separate storage, the new positions and colors are returned in
+    // positions and colors
+    bool allocate(int count, glm::vec3 *&positions, glm::vec4 *&colors)
+    {
+        if (_storage != StorageSeparate)
+        {
+            return false;
+        }
+
+        auto first = _positions.size();
+        _positions.resize(first + size_t(count));
+        _colors.resize(first + size_t(count));
+        _vertexCount = _positions.size();
+
+        positions = _positions.data() + first;
+        colors = _colors.data() + first;
+
+        return true;
+    }
+
+    BufferType& vertex(glm::vec3 const &position)
+    {
+        addVertex(VertexType({ position, _nextColor }));
+
         return *this;
     }
 
@@ -82,59 +690,471 @@ public:
     bool setup(GLenum mode, ShaderType &shader)
     {
         _drawMode = mode;
-        _vertexCount = _verts.size();
+
+        if (_indexed && _indices.empty())
+        {
+            deduplicate();
+        }
+
+        _vertexCount = storedCount();
+        _indexCount = _indices.size();
 
         glGenVertexArrays(1, &_vertexArrayId);
         glGenBuffers(1, &_vertexBufferId);
+        if (_storage == StorageSeparate)
+        {
+            glGenBuffers(1, &_colorBufferId);
+        }
 
-        glBindVertexArray(_vertexArrayId);
-        glBindBuffer(GL_ARRAY_BUFFER, _vertexBufferId);
+        stateCache().bindVertexArray(_vertexArrayId);
+        uploadVertices();
 
-        glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(_verts.size() * sizeof(VertexType)), 0, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(_verts.size() * sizeof(VertexType)), reinterpret_cast<const GLvoid*>(&_verts[0]));
+        // The VAO takes the buffer that is bound when an attribute is set up
+        auto format = vertexFormat();
+        stateCache().bindBuffer(GL_ARRAY_BUFFER, _vertexBufferId);
+        shader.setupPositionAttribute(format.stride, format.position);
+        if (_colorBufferId != 0)
+        {
+            stateCache().bindBuffer(GL_ARRAY_BUFFER, _colorBufferId);
+        }
+        shader.setupColorAttribute(format.stride, format.color);
 
-        glBindVertexArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        if (_indexed)
+        {
+            uploadIndices();
+        }
+
+        stateCache().bindVertexArray(0);
+        stateCache().bindBuffer(GL_ARRAY_BUFFER, 0);
+        stateCache().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-        glBindVertexArray(_vertexArrayId);
-        glBindBuffer(GL_ARRAY_BUFFER, _vertexBufferId);
-        shader.setupAttributes();
-        glBindVertexArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        setupFaces();
 
-        _verts.clear();
+        releaseVertices();
 
         return true;
     }
 
+    // Replaces the contents of a buffer that was set up before with the vertices
+    // (and indices) added since, reusing its GL objects
+    bool update()
+    {
+        if (_vertexArrayId == 0)
+        {
+            return false;
+        }
+
+        if (_indexed && _indices.empty())
+        {
+            deduplicate();
+        }
+
+        _vertexCount = storedCount();
+        _indexCount = _indices.size();
+
+        // Orphaning: the driver hands out new storage instead of waiting for the
+        // draws that still read the old contents
+        uploadVertices();
+
+        if (_indexed)
+        {
+            stateCache().bindVertexArray(_vertexArrayId);
+            uploadIndices();
+            stateCache().bindVertexArray(0);
+            stateCache().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        }
+
+        // uploadIndices() switches between 16 and 32 bit indices with the vertex count
+        setupFaces();
+
+        releaseVertices();
+
+        return true;
+    }
+
+    // Adds a buffer of InstanceType to the vertex array, call after setup() with
+    // a shader that reads the instance attributes, like the default instanced shader
+    bool setupInstances(ShaderType &shader)
+    {
+        if (_vertexArrayId == 0)
+        {
+            return false;
+        }
+
+        glGenBuffers(1, &_instanceBufferId);
+
+        stateCache().bindVertexArray(_vertexArrayId);
+        stateCache().bindBuffer(GL_ARRAY_BUFFER, _instanceBufferId);
+        shader.setupAttributes<InstanceTypeLayout>();
+        stateCache().bindVertexArray(0);
+        stateCache().bindBuffer(GL_ARRAY_BUFFER, 0);
+
+        return true;
+    }
+
+    // Replaces the instance data, the old storage is orphaned so this can be
+    // called every frame
+    void updateInstances(InstanceType const *instances, int count)
+    {
+        stateCache().bindBuffer(GL_ARRAY_BUFFER, _instanceBufferId);
+        glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(count * sizeof(InstanceType)), instances, GL_STREAM_DRAW);
+    }
+
+    // Draws the buffer once for each of the first instanceCount instances
+    void renderInstanced(GLsizei instanceCount)
+    {
+        stateCache().bindVertexArray(_vertexArrayId);
+        if (_faceFirsts.empty())
+        {
+            if (_indexed)
+            {
+                glDrawElementsInstanced(_drawMode, _indexCount, _indexType, nullptr, instanceCount);
+            }
+            else
+            {
+                glDrawArraysInstanced(_drawMode, 0, _vertexCount, instanceCount);
+            }
+        }
+        else
+        {
+            if (_facesDirty)
+            {
+                setupFaces();
+            }
+
+            for (size_t i = 0; i < _faceFirsts.size(); i++)
+            {
+                if (_indexed)
+                {
+                    glDrawElementsInstanced(_drawMode, _faceCounts[i], _indexType, _faceOffsets[i], instanceCount);
+                }
+                else
+                {
+                    glDrawArraysInstanced(_drawMode, _faceFirsts[i], _faceCounts[i], instanceCount);
+                }
+            }
+        }
+    }
+
+    unsigned int vertexArrayId() const
+    {
+        return _vertexArrayId;
+    }
+
+    GLenum drawMode() const
+    {
+        return _drawMode;
+    }
+
     void render()
     {
-        glBindVertexArray(_vertexArrayId);
-        if (_faces.empty())
+        stateCache().bindVertexArray(_vertexArrayId);
+        draw();
+    }
+
+    // Issues the draw calls of render() without binding the vertex array, for
+    // callers that already bound it and draw it more than once
+    void draw()
+    {
+        draw(_drawMode);
+    }
+
+    // Same as draw(), with another primitive mode than the one of setup()
+    void draw(GLenum mode)
+    {
+        if (_faceFirsts.empty())
         {
-            glDrawArrays(_drawMode, 0, _vertexCount);
+            if (_indexed)
+            {
+                // The vertex range lets the driver skip scanning the indices
+                glDrawRangeElements(mode, 0, GLuint(_vertexCount - 1), _indexCount, _indexType, nullptr);
+            }
+            else
+            {
+                glDrawArrays(mode, 0, _vertexCount);
+            }
+            return;
+        }
+
+        // Faces added after setup() are not in the offsets or the indirect buffer yet
+        if (_facesDirty)
+        {
+            setupFaces();
+        }
+
+        if (_indirectBufferId != 0)
+        {
+            stateCache().bindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBufferId);
+            if (_indexed)
+            {
+                glMultiDrawElementsIndirect(mode, _indexType, nullptr, GLsizei(_faceFirsts.size()), 0);
+            }
+            else
+            {
+                glMultiDrawArraysIndirect(mode, nullptr, GLsizei(_faceFirsts.size()), 0);
+            }
+        }
+        else if (_indexed)
+        {
+            glMultiDrawElements(mode, _faceCounts.data(), _indexType, _faceOffsets.data(), GLsizei(_faceFirsts.size()));
         }
         else
         {
-            for (auto pair : _faces)
+            glMultiDrawArrays(mode, _faceFirsts.data(), _faceCounts.data(), GLsizei(_faceFirsts.size()));
+        }
+    }
+
+    void cleanup()
+    {
+        if (_instanceBufferId != 0)
+        {
+            stateCache().deleteBuffer(_instanceBufferId);
+            _instanceBufferId = 0;
+        }
+        if (_indirectBufferId != 0)
+        {
+            stateCache().deleteBuffer(_indirectBufferId);
+            _indirectBufferId = 0;
+        }
+        if (_indexBufferId != 0)
+        {
+            stateCache().deleteBuffer(_indexBufferId);
+            _indexBufferId = 0;
+        }
+        if (_colorBufferId != 0)
+        {
+            stateCache().deleteBuffer(_colorBufferId);
+            _colorBufferId = 0;
+        }
+        if (_vertexBufferId != 0)
+        {
+            stateCache().deleteBuffer(_vertexBufferId);
+            _vertexBufferId = 0;
+        }
+        if (_vertexArrayId != 0)
+        {
+            stateCache().deleteVertexArray(_vertexArrayId);
+            _vertexArrayId = 0;
+        }
+    }
+};
+
+// Blocks until the GPU passed the fence, then deletes it
+inline void waitFence(GLsync &fence)
+{
+    if (fence != nullptr)
+    {
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+        { }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+}
+
+// Vertex ring buffer for geometry that is rebuilt every frame, like debug lines
+// and particles. The buffer holds one region per frame in flight and a region
+// is only written again after the GPU passed the fence of the frame that used
+// it, so writes never wait for the driver.
+//
+// With GL_ARB_buffer_storage the ring is one persistently mapped, coherent
+// allocation and map() hands out pointers straight into it. Without it every
+// allocation is mapped unsynchronized and the ring is orphaned when a frame
+// overflows its region, so draw every allocation before making the next one.
+class StreamBufferType
+{
+    static const int FramesInFlight = 3;
+
+    unsigned int _vertexArrayId;
+    unsigned int _vertexBufferId;
+    GLsizeiptr _regionSize;
+    GLsizeiptr _offset;
+    int _region;
+    GLsync _fences[FramesInFlight];
+    VertexType *_mapped;
+    VertexType *_storage;
+    bool _persistent;
+
+public:
+    StreamBufferType()
+        : _vertexArrayId(0), _vertexBufferId(0), _regionSize(0), _offset(0), _region(0), _fences(), _mapped(nullptr),
+          _storage(nullptr), _persistent(true)
+    { }
+
+    virtual ~StreamBufferType() { }
+
+    // Persistent mapping is used when the driver has GL_ARB_buffer_storage,
+    // call before setup() to always take the glMapBufferRange path
+    void setPersistent(bool persistent)
+    {
+        _persistent = persistent;
+    }
+
+    bool isPersistent() const
+    {
+        return _storage != nullptr;
+    }
+
+    bool setup(int verticesPerFrame, ShaderType &shader)
+    {
+        _regionSize = GLsizeiptr(verticesPerFrame * sizeof(VertexType));
+
+        glGenVertexArrays(1, &_vertexArrayId);
+        glGenBuffers(1, &_vertexBufferId);
+
+        stateCache().bindVertexArray(_vertexArrayId);
+        stateCache().bindBuffer(GL_ARRAY_BUFFER, _vertexBufferId);
+
+        if (_persistent && GLAD_GL_ARB_buffer_storage)
+        {
+            // Immutable storage stays mapped until cleanup(), coherent so the
+            // writes are seen by draws issued after them without flushing
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_ARRAY_BUFFER, _regionSize * FramesInFlight, nullptr, flags);
+            _storage = reinterpret_cast<VertexType*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, _regionSize * FramesInFlight, flags));
+        }
+
+        if (_storage == nullptr)
+        {
+            glBufferData(GL_ARRAY_BUFFER, _regionSize * FramesInFlight, nullptr, GL_STREAM_DRAW);
+        }
+
+        shader.setupAttributes<VertexTypeLayout>();
+        stateCache().bindVertexArray(0);
+        stateCache().bindBuffer(GL_ARRAY_BUFFER, 0);
+
+        return true;
+    }
+
+    // Waits until the GPU is done with the region of this frame, which only
+    // blocks when the CPU runs more than FramesInFlight frames ahead
+    void beginFrame()
+    {
+        waitFence(_fences[_region]);
+
+        _offset = 0;
+    }
+
+    // Returns room for count vertices and the index of the first one in first.
+    // Write the vertices, then call unmap() before drawing.
+    VertexType *map(int count, GLint &first)
+    {
+        auto size = GLsizeiptr(count * sizeof(VertexType));
+        if (size > _regionSize)
+        {
+            return nullptr;
+        }
+
+        if (_offset + size > _regionSize)
+        {
+            if (_storage != nullptr)
+            {
+                // Immutable storage can not be orphaned, wait for the draws of
+                // this frame before starting over at the region start
+                auto fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                waitFence(fence);
+            }
+            else
             {
-                glDrawArrays(_drawMode, pair.first, pair.second);
+                // Orphan the whole ring, the driver keeps the old storage alive for
+                // the draws that still use it. The fences guard the old storage only.
+                stateCache().bindBuffer(GL_ARRAY_BUFFER, _vertexBufferId);
+                glBufferData(GL_ARRAY_BUFFER, _regionSize * FramesInFlight, nullptr, GL_STREAM_DRAW);
+                for (auto &fence : _fences)
+                {
+                    if (fence != nullptr)
+                    {
+                        glDeleteSync(fence);
+                        fence = nullptr;
+                    }
+                }
             }
+            _offset = 0;
+        }
+
+        auto offset = _region * _regionSize + _offset;
+        first = GLint(offset / GLsizeiptr(sizeof(VertexType)));
+        _offset += size;
+
+        if (_storage != nullptr)
+        {
+            return _storage + first;
         }
-        glBindVertexArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        stateCache().bindBuffer(GL_ARRAY_BUFFER, _vertexBufferId);
+        _mapped = reinterpret_cast<VertexType*>(glMapBufferRange(GL_ARRAY_BUFFER, offset, size,
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT));
+
+        return _mapped;
+    }
+
+    // Does nothing for a persistently mapped ring
+    void unmap()
+    {
+        if (_mapped != nullptr)
+        {
+            stateCache().bindBuffer(GL_ARRAY_BUFFER, _vertexBufferId);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            _mapped = nullptr;
+        }
+    }
+
+    // Copies the vertices into the ring, returns the first index or -1 when they do not fit
+    GLint upload(VertexType const *verts, int count)
+    {
+        GLint first = -1;
+        auto mapped = map(count, first);
+        if (mapped == nullptr)
+        {
+            return -1;
+        }
+
+        std::copy(verts, verts + count, mapped);
+        unmap();
+
+        return first;
+    }
+
+    void render(GLenum mode, GLint first, GLsizei count)
+    {
+        stateCache().bindVertexArray(_vertexArrayId);
+        glDrawArrays(mode, first, count);
+    }
+
+    // Fences the region of this frame and moves on to the next one
+    void endFrame()
+    {
+        _fences[_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        _region = (_region + 1) % FramesInFlight;
     }
 
     void cleanup()
     {
+        unmap();
+
+        if (_storage != nullptr)
+        {
+            stateCache().bindBuffer(GL_ARRAY_BUFFER, _vertexBufferId);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            stateCache().bindBuffer(GL_ARRAY_BUFFER, 0);
+            _storage = nullptr;
+        }
+
+        for (auto &fence : _fences)
+        {
+            if (fence != nullptr)
+            {
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+        }
         if (_vertexBufferId != 0)
         {
-            glDeleteBuffers(1, &_vertexBufferId);
+            stateCache().deleteBuffer(_vertexBufferId);
             _vertexBufferId = 0;
         }
         if (_vertexArrayId != 0)
         {
-            glDeleteVertexArrays(1, &_vertexArrayId);
+            stateCache().deleteVertexArray(_vertexArrayId);
             _vertexArrayId = 0;
         }
     }
@@ -2,172 +2,590 @@
 #define GLMATH_H
 
 #include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <sstream>
 
+// The mat4 and vec4 kernels use SSE (two columns at a time with AVX) or NEON
+// when the compiler targets them. Define GLM_FORCE_SCALAR to use the scalar
+// reference implementations instead. All functions are inline, so every
+// translation unit of a program must be built with the same instruction set
+// flags, otherwise the linker may pick any of the differing definitions.
+#if !defined(GLM_FORCE_SCALAR)
+#if defined(__AVX__)
+#define GLM_SIMD_AVX
+#define GLM_SIMD_SSE
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define GLM_SIMD_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define GLM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 namespace glm
 {
 
+// The components are stored in an array, so indexing is a plain array access
+// that vectorizes and folds at compile time. x/y/z/w and r/g/b/a alias the same
+// floats through anonymous structs (supported by GCC, Clang and MSVC). In
+// constant expressions only data and operator[] can be read, because the
+// constructors initialize data.
+
 struct vec3
 {
-    vec3() : x(0), y(0), z(0) { }
-    vec3(float v) : x(v), y(v), z(v) { }
-    vec3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) { }
-
-    union { float x; float r; };
-    union { float y; float g; };
-    union { float z; float b; };
+    constexpr vec3() : data{ 0, 0, 0 } { }
+    constexpr vec3(float v) : data{ v, v, v } { }
+    constexpr vec3(float _x, float _y, float _z) : data{ _x, _y, _z } { }
 
-    float const &operator[] (int index) const
+    union
     {
-        if (index == 0) return x;
-        if (index == 1) return y;
+        float data[3];
+        struct { float x, y, z; };
+        struct { float r, g, b; };
+    };
 
-        return z;
+    constexpr float const &operator[] (int index) const
+    {
+        return data[index];
     }
 
-    float &operator[] (int index)
+    constexpr float &operator[] (int index)
     {
-        if (index == 0) return x;
-        if (index == 1) return y;
-
-        return z;
+        return data[index];
     }
 };
 
-vec3 operator + (vec3 const &v1, vec3 const &v2)
+constexpr vec3 operator + (vec3 const &v1, vec3 const &v2)
 {
-    return vec3(v1.x + v2.x, v1.y + v2.y, v1.z + v2.z);
+    return vec3(v1[0] + v2[0], v1[1] + v2[1], v1[2] + v2[2]);
 }
 
-vec3 operator - (vec3 const &v1, vec3 const &v2)
+constexpr vec3 operator - (vec3 const &v1, vec3 const &v2)
 {
-    return vec3(v1.x - v2.x, v1.y - v2.y, v1.z - v2.z);
+    return vec3(v1[0] - v2[0], v1[1] - v2[1], v1[2] - v2[2]);
 }
 
-vec3 cross(vec3 const &v1, vec3 const &v2)
+constexpr vec3 operator - (vec3 const &v)
 {
-    return vec3(v1.y * v2.z - v1.z * v2.y,
-                v1.z * v2.x - v1.x * v2.z,
-                v1.x * v2.y - v1.y * v2.x);
+    return vec3(-v[0], -v[1], -v[2]);
 }
 
-float length(vec3 const &v)
+constexpr vec3 operator * (vec3 const &v, float s)
 {
-    return float(sqrt(v.x*v.x + v.y*v.y + v.z*v.z));
+    return vec3(v[0] * s, v[1] * s, v[2] * s);
 }
 
-vec3 normal(vec3 const &v)
+constexpr vec3 cross(vec3 const &v1, vec3 const &v2)
+{
+    return vec3(v1[1] * v2[2] - v1[2] * v2[1],
+                v1[2] * v2[0] - v1[0] * v2[2],
+                v1[0] * v2[1] - v1[1] * v2[0]);
+}
+
+constexpr float dot(vec3 const &v1, vec3 const &v2)
+{
+    return v1[0] * v2[0] + v1[1] * v2[1] + v1[2] * v2[2];
+}
+
+inline float length(vec3 const &v)
+{
+    return float(sqrt(dot(v, v)));
+}
+
+inline vec3 normal(vec3 const &v)
 {
     auto l = length(v);
     return vec3(v.x / l, v.y / l, v.z / l);
 }
 
-struct vec4
+struct alignas(16) vec4
 {
-    vec4() : x(0), y(0), z(0), w(0) { }
-    vec4(float v) : x(v), y(v), z(v), w(v) { }
-    vec4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) { }
+    constexpr vec4() : data{ 0, 0, 0, 0 } { }
+    constexpr vec4(float v) : data{ v, v, v, v } { }
+    constexpr vec4(float _x, float _y, float _z, float _w) : data{ _x, _y, _z, _w } { }
+    constexpr vec4(vec3 const &v, float _w) : data{ v[0], v[1], v[2], _w } { }
 
-    union { float x; float r; };
-    union { float y; float g; };
-    union { float z; float b; };
-    union { float w; float a; };
-
-    float const &operator[] (int index) const
+    union
     {
-        if (index == 0) return x;
-        if (index == 1) return y;
-        if (index == 2) return z;
+        float data[4];
+        struct { float x, y, z, w; };
+        struct { float r, g, b, a; };
+    };
 
-        return w;
+    constexpr float const &operator[] (int index) const
+    {
+        return data[index];
     }
 
-    float &operator[] (int index)
+    constexpr float &operator[] (int index)
     {
-        if (index == 0) return x;
-        if (index == 1) return y;
-        if (index == 2) return z;
-
-        return w;
+        return data[index];
     }
 };
 
-struct mat4
+constexpr vec4 operator + (vec4 const &v1, vec4 const &v2)
 {
-    mat4() { }
-    mat4(float v)
-    {
-        // Identity
-        values[0].x = v;
-        values[1].y = v;
-        values[2].z = v;
-        values[3].w = v;
-    }
-    mat4(vec4 const &v0, vec4 const &v1, vec4 const &v2, vec4 const &v3)
-    {
-        values[0] = v0;
-        values[1] = v1;
-        values[2] = v2;
-        values[3] = v3;
-    }
+    return vec4(v1[0] + v2[0], v1[1] + v2[1], v1[2] + v2[2], v1[3] + v2[3]);
+}
+
+constexpr vec4 operator - (vec4 const &v1, vec4 const &v2)
+{
+    return vec4(v1[0] - v2[0], v1[1] - v2[1], v1[2] - v2[2], v1[3] - v2[3]);
+}
+
+constexpr vec4 operator * (vec4 const &v, float s)
+{
+    return vec4(v[0] * s, v[1] * s, v[2] * s, v[3] * s);
+}
+
+struct alignas(16) mat4
+{
+    constexpr mat4() : values{ } { }
+    constexpr mat4(float v)
+        : values{ vec4(v, 0, 0, 0), vec4(0, v, 0, 0), vec4(0, 0, v, 0), vec4(0, 0, 0, v) }
+    { }
+    constexpr mat4(vec4 const &v0, vec4 const &v1, vec4 const &v2, vec4 const &v3)
+        : values{ v0, v1, v2, v3 }
+    { }
 
     vec4 values[4];
 
-    vec4 const &operator [] (int index) const
+    constexpr vec4 const &operator [] (int index) const
     {
         return values[index];
     }
 
-    vec4 &operator [] (int index)
+    constexpr vec4 &operator [] (int index)
     {
         return values[index];
     }
 };
 
-vec4 operator * (mat4 const &m, vec4 const &v)
+namespace detail
+{
+
+// Scalar reference implementations, used when no SIMD instruction set is
+// available and to verify the SIMD kernels against
+
+inline vec4 mul_reference(mat4 const &m, vec4 const &v)
 {
     return vec4(
-        m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2] + m[3][0] * v[3],
-        m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2] + m[3][1] * v[3],
-        m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2] + m[3][2] * v[3],
-        m[0][3] * v[0] + m[1][3] * v[1] + m[2][3] * v[2] + m[3][3] * v[3]
+        m.values[0].x * v.x + m.values[1].x * v.y + m.values[2].x * v.z + m.values[3].x * v.w,
+        m.values[0].y * v.x + m.values[1].y * v.y + m.values[2].y * v.z + m.values[3].y * v.w,
+        m.values[0].z * v.x + m.values[1].z * v.y + m.values[2].z * v.z + m.values[3].z * v.w,
+        m.values[0].w * v.x + m.values[1].w * v.y + m.values[2].w * v.z + m.values[3].w * v.w
     );
 }
 
-vec4 operator * (vec4 const &v, mat4 const &m)
+inline mat4 mul_reference(mat4 const &m1, mat4 const &m2)
 {
-    return vec4(
-        v[0] * m[0][0] + v[1] * m[0][1] + v[2] * m[0][2] + v[3] * m[0][3],
-        v[0] * m[1][0] + v[1] * m[1][1] + v[2] * m[1][2] + v[3] * m[1][3],
-        v[0] * m[2][0] + v[1] * m[2][1] + v[2] * m[2][2] + v[3] * m[2][3],
-        v[0] * m[3][0] + v[1] * m[3][1] + v[2] * m[3][2] + v[3] * m[3][3]
+    return mat4(
+        mul_reference(m1, m2.values[0]),
+        mul_reference(m1, m2.values[1]),
+        mul_reference(m1, m2.values[2]),
+        mul_reference(m1, m2.values[3])
     );
 }
 
-mat4 operator * (mat4 const &m1, mat4 const &m2)
+inline mat4 transpose_reference(mat4 const &m)
+{
+    return mat4(
+        vec4(m.values[0].x, m.values[1].x, m.values[2].x, m.values[3].x),
+        vec4(m.values[0].y, m.values[1].y, m.values[2].y, m.values[3].y),
+        vec4(m.values[0].z, m.values[1].z, m.values[2].z, m.values[3].z),
+        vec4(m.values[0].w, m.values[1].w, m.values[2].w, m.values[3].w)
+    );
+}
+
+// Inverse from the cross products of the column pairs, with a, b, c and d the
+// columns of the matrix (Lengyel, Foundations of Game Engine Development 1)
+inline mat4 inverse_reference(mat4 const &m)
+{
+    auto const &a4 = m.values[0];
+    auto const &b4 = m.values[1];
+    auto const &c4 = m.values[2];
+    auto const &d4 = m.values[3];
+
+    vec3 a(a4.x, a4.y, a4.z), b(b4.x, b4.y, b4.z), c(c4.x, c4.y, c4.z), d(d4.x, d4.y, d4.z);
+
+    auto s = cross(a, b);
+    auto t = cross(c, d);
+    auto u = vec3(a.x * b4.w - b.x * a4.w, a.y * b4.w - b.y * a4.w, a.z * b4.w - b.z * a4.w);
+    auto v = vec3(c.x * d4.w - d.x * c4.w, c.y * d4.w - d.y * c4.w, c.z * d4.w - d.z * c4.w);
+
+    auto invDet = 1.0f / (dot(s, v) + dot(t, u));
+    s = vec3(s.x * invDet, s.y * invDet, s.z * invDet);
+    t = vec3(t.x * invDet, t.y * invDet, t.z * invDet);
+    u = vec3(u.x * invDet, u.y * invDet, u.z * invDet);
+    v = vec3(v.x * invDet, v.y * invDet, v.z * invDet);
+
+    auto r0 = cross(b, v) + vec3(t.x * b4.w, t.y * b4.w, t.z * b4.w);
+    auto r1 = cross(v, a) - vec3(t.x * a4.w, t.y * a4.w, t.z * a4.w);
+    auto r2 = cross(d, u) + vec3(s.x * d4.w, s.y * d4.w, s.z * d4.w);
+    auto r3 = cross(u, c) - vec3(s.x * c4.w, s.y * c4.w, s.z * c4.w);
+
+    // r0 to r3 are the rows of the inverse
+    return mat4(
+        vec4(r0.x, r1.x, r2.x, r3.x),
+        vec4(r0.y, r1.y, r2.y, r3.y),
+        vec4(r0.z, r1.z, r2.z, r3.z),
+        vec4(-dot(b, t), dot(a, t), -dot(d, s), dot(c, s))
+    );
+}
+
+#if defined(GLM_SIMD_SSE)
+
+inline __m128 load(vec4 const &v)
+{
+    return _mm_load_ps(v.data);
+}
+
+inline vec4 store(__m128 r)
+{
+    vec4 v;
+    _mm_store_ps(v.data, r);
+    return v;
+}
+
+#define GLM_SPLAT(v, i) _mm_shuffle_ps((v), (v), _MM_SHUFFLE(i, i, i, i))
+
+inline __m128 mul(mat4 const &m, __m128 v)
+{
+    auto r = _mm_mul_ps(load(m.values[0]), GLM_SPLAT(v, 0));
+    r = _mm_add_ps(r, _mm_mul_ps(load(m.values[1]), GLM_SPLAT(v, 1)));
+    r = _mm_add_ps(r, _mm_mul_ps(load(m.values[2]), GLM_SPLAT(v, 2)));
+    r = _mm_add_ps(r, _mm_mul_ps(load(m.values[3]), GLM_SPLAT(v, 3)));
+    return r;
+}
+
+// 3D cross product of the xyz lanes, the w lane is zero
+inline __m128 cross3(__m128 a, __m128 b)
+{
+    auto a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    auto b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    auto c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+inline float dot4(__m128 a, __m128 b)
+{
+    auto p = _mm_mul_ps(a, b);
+    p = _mm_add_ps(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 3, 0, 1)));
+    p = _mm_add_ps(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(p);
+}
+
+#endif // GLM_SIMD_SSE
+
+}
+
+inline vec4 operator * (mat4 const &m, vec4 const &v)
+{
+#if defined(GLM_SIMD_SSE)
+    return detail::store(detail::mul(m, detail::load(v)));
+#elif defined(GLM_SIMD_NEON)
+    auto r = vmulq_n_f32(vld1q_f32(m.values[0].data), v.x);
+    r = vmlaq_n_f32(r, vld1q_f32(m.values[1].data), v.y);
+    r = vmlaq_n_f32(r, vld1q_f32(m.values[2].data), v.z);
+    r = vmlaq_n_f32(r, vld1q_f32(m.values[3].data), v.w);
+    vec4 result;
+    vst1q_f32(&result.x, r);
+    return result;
+#else
+    return detail::mul_reference(m, v);
+#endif
+}
+
+inline mat4 transpose(mat4 const &m)
+{
+#if defined(GLM_SIMD_SSE)
+    auto c0 = detail::load(m.values[0]);
+    auto c1 = detail::load(m.values[1]);
+    auto c2 = detail::load(m.values[2]);
+    auto c3 = detail::load(m.values[3]);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    return mat4(detail::store(c0), detail::store(c1), detail::store(c2), detail::store(c3));
+#elif defined(GLM_SIMD_NEON)
+    // De-interleaving load, every fourth float ends up in the same register
+    auto t = vld4q_f32(m.values[0].data);
+    mat4 result;
+    vst1q_f32(&result.values[0].x, t.val[0]);
+    vst1q_f32(&result.values[1].x, t.val[1]);
+    vst1q_f32(&result.values[2].x, t.val[2]);
+    vst1q_f32(&result.values[3].x, t.val[3]);
+    return result;
+#else
+    return detail::transpose_reference(m);
+#endif
+}
+
+inline vec4 operator * (vec4 const &v, mat4 const &m)
+{
+#if defined(GLM_SIMD_SSE)
+    // Every lane of the result is the dot product of v with a column of m
+    auto vv = detail::load(v);
+    auto p0 = _mm_mul_ps(vv, detail::load(m.values[0]));
+    auto p1 = _mm_mul_ps(vv, detail::load(m.values[1]));
+    auto p2 = _mm_mul_ps(vv, detail::load(m.values[2]));
+    auto p3 = _mm_mul_ps(vv, detail::load(m.values[3]));
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    return detail::store(_mm_add_ps(_mm_add_ps(p0, p1), _mm_add_ps(p2, p3)));
+#else
+    return transpose(m) * v;
+#endif
+}
+
+inline mat4 operator * (mat4 const &m1, mat4 const &m2)
 {
+#if defined(GLM_SIMD_AVX)
+    // Two columns of the result per iteration, m1's columns are broadcast to both halves
+    auto a0 = _mm256_broadcast_ps(reinterpret_cast<__m128 const *>(m1.values[0].data));
+    auto a1 = _mm256_broadcast_ps(reinterpret_cast<__m128 const *>(m1.values[1].data));
+    auto a2 = _mm256_broadcast_ps(reinterpret_cast<__m128 const *>(m1.values[2].data));
+    auto a3 = _mm256_broadcast_ps(reinterpret_cast<__m128 const *>(m1.values[3].data));
+
+    mat4 result;
+    for (int i = 0; i < 4; i += 2)
+    {
+        auto b = _mm256_loadu_ps(m2.values[i].data);
+        auto r = _mm256_mul_ps(a0, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(0, 0, 0, 0)));
+        r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(1, 1, 1, 1))));
+        r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 2, 2))));
+        r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 3, 3))));
+        _mm256_storeu_ps(&result.values[i].x, r);
+    }
+    return result;
+#elif defined(GLM_SIMD_SSE)
+    mat4 result;
+    for (int i = 0; i < 4; i++)
+    {
+        _mm_store_ps(&result.values[i].x, detail::mul(m1, detail::load(m2.values[i])));
+    }
+    return result;
+#else
     vec4 X = m1 * m2[0];
     vec4 Y = m1 * m2[1];
     vec4 Z = m1 * m2[2];
     vec4 W = m1 * m2[3];
 
     return mat4(X, Y, Z, W);
+#endif
+}
+
+// The matrix must be invertible, a singular matrix gives infinities
+inline mat4 inverse(mat4 const &m)
+{
+#if defined(GLM_SIMD_SSE)
+    auto a = detail::load(m.values[0]);
+    auto b = detail::load(m.values[1]);
+    auto c = detail::load(m.values[2]);
+    auto d = detail::load(m.values[3]);
+
+    // The w lanes of s, t, u and v all end up zero
+    auto s = detail::cross3(a, b);
+    auto t = detail::cross3(c, d);
+    auto u = _mm_sub_ps(_mm_mul_ps(a, GLM_SPLAT(b, 3)), _mm_mul_ps(b, GLM_SPLAT(a, 3)));
+    auto v = _mm_sub_ps(_mm_mul_ps(c, GLM_SPLAT(d, 3)), _mm_mul_ps(d, GLM_SPLAT(c, 3)));
+
+    auto invDet = _mm_set1_ps(1.0f / (detail::dot4(s, v) + detail::dot4(t, u)));
+    s = _mm_mul_ps(s, invDet);
+    t = _mm_mul_ps(t, invDet);
+    u = _mm_mul_ps(u, invDet);
+    v = _mm_mul_ps(v, invDet);
+
+    auto r0 = _mm_add_ps(detail::cross3(b, v), _mm_mul_ps(t, GLM_SPLAT(b, 3)));
+    auto r1 = _mm_sub_ps(detail::cross3(v, a), _mm_mul_ps(t, GLM_SPLAT(a, 3)));
+    auto r2 = _mm_add_ps(detail::cross3(d, u), _mm_mul_ps(s, GLM_SPLAT(d, 3)));
+    auto r3 = _mm_sub_ps(detail::cross3(u, c), _mm_mul_ps(s, GLM_SPLAT(c, 3)));
+
+    // r0 to r3 are the rows of the inverse, the last column is made of dot products
+    auto p0 = _mm_mul_ps(b, t);
+    auto p1 = _mm_mul_ps(a, t);
+    auto p2 = _mm_mul_ps(d, s);
+    auto p3 = _mm_mul_ps(c, s);
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    auto w = _mm_mul_ps(_mm_add_ps(_mm_add_ps(p0, p1), _mm_add_ps(p2, p3)), _mm_setr_ps(-1.0f, 1.0f, -1.0f, 1.0f));
+
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    return mat4(detail::store(r0), detail::store(r1), detail::store(r2), detail::store(w));
+#else
+    return detail::inverse_reference(m);
+#endif
 }
 
-float radians(float degrees)
+struct aabb
+{
+    vec3 min;
+    vec3 max;
+};
+
+// Batched transforms over contiguous arrays. in and out may be the same array,
+// but must not partially overlap.
+
+// out[i] = m * in[i]
+inline void transform(mat4 const &m, vec4 const *in, vec4 *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        out[i] = m * in[i];
+    }
+}
+
+// out[i] = (m * vec4(in[i], 1)).xyz, for affine matrices (no perspective divide)
+inline void transform(mat4 const &m, vec3 const *in, vec3 *out, size_t count)
+{
+    size_t i = 0;
+
+#if defined(GLM_SIMD_SSE)
+    auto m00 = _mm_set1_ps(m[0].x), m01 = _mm_set1_ps(m[0].y), m02 = _mm_set1_ps(m[0].z);
+    auto m10 = _mm_set1_ps(m[1].x), m11 = _mm_set1_ps(m[1].y), m12 = _mm_set1_ps(m[1].z);
+    auto m20 = _mm_set1_ps(m[2].x), m21 = _mm_set1_ps(m[2].y), m22 = _mm_set1_ps(m[2].z);
+    auto m30 = _mm_set1_ps(m[3].x), m31 = _mm_set1_ps(m[3].y), m32 = _mm_set1_ps(m[3].z);
+
+    // Four points per iteration, de-interleaved into one register per component
+    for (; i + 4 <= count; i += 4)
+    {
+        auto src = reinterpret_cast<float const *>(in + i);
+        auto p0 = _mm_loadu_ps(src + 0);    // x0 y0 z0 x1
+        auto p1 = _mm_loadu_ps(src + 4);    // y1 z1 x2 y2
+        auto p2 = _mm_loadu_ps(src + 8);    // z2 x3 y3 z3
+
+        auto t = _mm_shuffle_ps(p1, p2, _MM_SHUFFLE(0, 1, 0, 2));
+        auto x = _mm_shuffle_ps(p0, t, _MM_SHUFFLE(2, 0, 3, 0));
+        auto u = _mm_shuffle_ps(p0, p1, _MM_SHUFFLE(3, 0, 1, 1));
+        auto w = _mm_shuffle_ps(p1, p2, _MM_SHUFFLE(2, 2, 3, 3));
+        auto y = _mm_shuffle_ps(u, w, _MM_SHUFFLE(2, 0, 2, 0));
+        auto a = _mm_shuffle_ps(p0, p1, _MM_SHUFFLE(1, 1, 2, 2));
+        auto z = _mm_shuffle_ps(a, p2, _MM_SHUFFLE(3, 0, 2, 0));
+
+        auto rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, x), _mm_mul_ps(m10, y)), _mm_add_ps(_mm_mul_ps(m20, z), m30));
+        auto ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m01, x), _mm_mul_ps(m11, y)), _mm_add_ps(_mm_mul_ps(m21, z), m31));
+        auto rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m02, x), _mm_mul_ps(m12, y)), _mm_add_ps(_mm_mul_ps(m22, z), m32));
+
+        // Interleave back into x y z triples
+        auto dst = reinterpret_cast<float *>(out + i);
+        _mm_storeu_ps(dst + 0, _mm_shuffle_ps(_mm_shuffle_ps(rx, ry, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(rz, rx, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(dst + 4, _mm_shuffle_ps(_mm_shuffle_ps(ry, rz, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(rx, ry, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(dst + 8, _mm_shuffle_ps(_mm_shuffle_ps(rz, rx, _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(ry, rz, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+    }
+#elif defined(GLM_SIMD_NEON)
+    for (; i + 4 <= count; i += 4)
+    {
+        // De-interleaving load, p.val[0] holds the x of four points
+        auto p = vld3q_f32(reinterpret_cast<float const *>(in + i));
+
+        float32x4x3_t r;
+        r.val[0] = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(m[3].x), p.val[0], m[0].x), p.val[1], m[1].x), p.val[2], m[2].x);
+        r.val[1] = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(m[3].y), p.val[0], m[0].y), p.val[1], m[1].y), p.val[2], m[2].y);
+        r.val[2] = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(m[3].z), p.val[0], m[0].z), p.val[1], m[1].z), p.val[2], m[2].z);
+
+        vst3q_f32(reinterpret_cast<float *>(out + i), r);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        auto const p = in[i];
+        out[i] = vec3(
+            m[0].x * p.x + m[1].x * p.y + m[2].x * p.z + m[3].x,
+            m[0].y * p.x + m[1].y * p.y + m[2].y * p.z + m[3].y,
+            m[0].z * p.x + m[1].z * p.y + m[2].z * p.z + m[3].z
+        );
+    }
+}
+
+// out[i] = m * in[i], for example a view-projection times every model matrix
+inline void multiply(mat4 const &m, mat4 const *in, mat4 *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        out[i] = m * in[i];
+    }
+}
+
+// Bounding boxes of the transformed boxes, for affine matrices
+inline void transform(mat4 const &m, aabb const *in, aabb *out, size_t count)
+{
+#if defined(GLM_SIMD_SSE)
+    auto const signMask = _mm_set1_ps(-0.0f);
+    auto c0 = detail::load(m[0]), c1 = detail::load(m[1]), c2 = detail::load(m[2]), c3 = detail::load(m[3]);
+    auto a0 = _mm_andnot_ps(signMask, c0), a1 = _mm_andnot_ps(signMask, c1), a2 = _mm_andnot_ps(signMask, c2);
+    auto const half = _mm_set1_ps(0.5f);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        auto lo = _mm_setr_ps(in[i].min.x, in[i].min.y, in[i].min.z, 0.0f);
+        auto hi = _mm_setr_ps(in[i].max.x, in[i].max.y, in[i].max.z, 0.0f);
+        auto center = _mm_mul_ps(_mm_add_ps(lo, hi), half);
+        auto extent = _mm_mul_ps(_mm_sub_ps(hi, lo), half);
+
+        // The extent is transformed by the absolute rotation/scale part (Arvo)
+        auto c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, GLM_SPLAT(center, 0)), _mm_mul_ps(c1, GLM_SPLAT(center, 1))), _mm_add_ps(_mm_mul_ps(c2, GLM_SPLAT(center, 2)), c3));
+        auto e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, GLM_SPLAT(extent, 0)), _mm_mul_ps(a1, GLM_SPLAT(extent, 1))), _mm_mul_ps(a2, GLM_SPLAT(extent, 2)));
+
+        auto rmin = detail::store(_mm_sub_ps(c, e));
+        auto rmax = detail::store(_mm_add_ps(c, e));
+        out[i].min = vec3(rmin.x, rmin.y, rmin.z);
+        out[i].max = vec3(rmax.x, rmax.y, rmax.z);
+    }
+#else
+    for (size_t i = 0; i < count; i++)
+    {
+        auto center = vec4((in[i].min.x + in[i].max.x) * 0.5f, (in[i].min.y + in[i].max.y) * 0.5f, (in[i].min.z + in[i].max.z) * 0.5f, 1.0f);
+        auto extent = vec3((in[i].max.x - in[i].min.x) * 0.5f, (in[i].max.y - in[i].min.y) * 0.5f, (in[i].max.z - in[i].min.z) * 0.5f);
+
+        auto c = m * center;
+        auto e = vec3(
+            std::fabs(m[0].x) * extent.x + std::fabs(m[1].x) * extent.y + std::fabs(m[2].x) * extent.z,
+            std::fabs(m[0].y) * extent.x + std::fabs(m[1].y) * extent.y + std::fabs(m[2].y) * extent.z,
+            std::fabs(m[0].z) * extent.x + std::fabs(m[1].z) * extent.y + std::fabs(m[2].z) * extent.z
+        );
+
+        out[i].min = vec3(c.x - e.x, c.y - e.y, c.z - e.z);
+        out[i].max = vec3(c.x + e.x, c.y + e.y, c.z + e.z);
+    }
+#endif
+}
+
+#undef GLM_SPLAT
+
+constexpr float radians(float degrees)
 {
     return degrees * 0.01745329251994329576923690768489f;
 }
 
-float const *value_ptr(mat4 const &m)
+inline float const *value_ptr(mat4 const &m)
+{
+    return m.values[0].data;
+}
+
+constexpr mat4 translate(vec3 const &v)
 {
-    return &m.values[0].x;
+    return mat4(
+        vec4(  1,    0,    0,   0),
+        vec4(  0,    1,    0,   0),
+        vec4(  0,    0,    1,   0),
+        vec4(v[0], v[1], v[2],  1)
+    );
 }
 
-mat4 perspective(float fovy, float aspect, float zNear, float zFar)
+constexpr mat4 scale(vec3 const &v)
 {
-    float const tanHalfFovy = tan(fovy / static_cast<float>(2));
+    return mat4(
+        vec4(v[0],  0,    0,   0),
+        vec4(  0,  v[1],  0,   0),
+        vec4(  0,   0,  v[2],  0),
+        vec4(  0,   0,    0,   1)
+    );
+}
 
+// perspective() with tan(fovy / 2) already computed, std::tan is not constexpr
+// so this is the part that can be evaluated at compile time
+constexpr mat4 perspectiveTan(float tanHalfFovy, float aspect, float zNear, float zFar)
+{
     mat4 m(static_cast<float>(0));
     m[0][0] = static_cast<float>(1) / (aspect * tanHalfFovy);
     m[1][1] = static_cast<float>(1) / (tanHalfFovy);
@@ -178,7 +596,12 @@ mat4 perspective(float fovy, float aspect, float zNear, float zFar)
     return m;
 }
 
-mat4 lookAt(vec3 const &eye, vec3 const &target, vec3 const &up)
+inline mat4 perspective(float fovy, float aspect, float zNear, float zFar)
+{
+    return perspectiveTan(tan(fovy / static_cast<float>(2)), aspect, zNear, zFar);
+}
+
+inline mat4 lookAt(vec3 const &eye, vec3 const &target, vec3 const &up)
 {
     vec3 zaxis = normal(eye - target);
     vec3 xaxis = normal(cross(up, zaxis));
@@ -191,17 +614,61 @@ mat4 lookAt(vec3 const &eye, vec3 const &target, vec3 const &up)
         vec4(  0,       0,       0,     1)
     };
 
-    mat4 translation = {
-        vec4(   1,      0,      0,   0),
-        vec4(   0,      1,      0,   0),
-        vec4(   0,      0,      1,   0),
-        vec4(-eye.x, -eye.y, -eye.z, 1)
-    };
+    return (orientation * translate(-eye));
+}
+
+// Converts to an IEEE half float with round to nearest even, the bits are ready
+// to be uploaded as GL_HALF_FLOAT
+inline unsigned short packHalf1x16(float v)
+{
+    unsigned int bits;
+    memcpy(&bits, &v, sizeof(bits));
+
+    auto sign = (bits >> 16) & 0x8000u;
+    auto mantissa = bits & 0x7fffffu;
+    auto exponent = int((bits >> 23) & 0xff) - 127 + 15;
+
+    if (((bits >> 23) & 0xff) == 0xff)
+    {
+        return static_cast<unsigned short>(sign | 0x7c00u | (mantissa != 0 ? 0x200u : 0u)); // inf and nan
+    }
+    if (exponent >= 31)
+    {
+        return static_cast<unsigned short>(sign | 0x7c00u); // too big, becomes inf
+    }
+
+    unsigned int shift = 13;
+    auto half = sign;
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+        {
+            return static_cast<unsigned short>(sign); // too small, becomes zero
+        }
+
+        // Subnormal, the implicit leading bit becomes explicit
+        mantissa |= 0x800000u;
+        shift = unsigned(14 - exponent);
+    }
+    else
+    {
+        half |= unsigned(exponent) << 10;
+    }
+
+    half |= mantissa >> shift;
+
+    // A carry out of the mantissa correctly bumps the exponent
+    auto rest = mantissa & ((1u << shift) - 1);
+    auto halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1) != 0))
+    {
+        half++;
+    }
 
-    return (orientation * translation);
+    return static_cast<unsigned short>(half);
 }
 
-std::string to_string(vec4 const &x)
+inline std::string to_string(vec4 const &x)
 {
     std::stringstream ss;
 
@@ -210,7 +677,7 @@ std::string to_string(vec4 const &x)
     return ss.str();
 }
 
-std::string to_string(mat4 const &x)
+inline std::string to_string(mat4 const &x)
 {
     std::stringstream ss;
 
@@ -2,25 +2,890 @@
 #define GLSHADER_H
 
 #include "glad/glad.h"
+#include "glmath.h"
+#include "glstate.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <memory>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+// How one attribute is stored in a vertex buffer, as passed to glVertexAttribPointer
+struct VertexAttribute
+{
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    size_t offset;
+};
+
+// Storage of the attributes of the default shader, positions and colors can be
+// stored in compact types that the GPU converts to floats when fetching them
+struct VertexFormat
+{
+    GLsizei stride;
+    VertexAttribute position;
+    VertexAttribute color;
+};
+
+// GL description of a C++ type used as vertex attribute, specialize it to use
+// other types in a VertexLayout. Matrices take one attribute location per column.
+template <typename T>
+struct AttributeTraits
+{
+    static_assert(sizeof(T) == 0, "no GL vertex attribute type known for this type, specialize AttributeTraits");
+};
+
+template <>
+struct AttributeTraits<float>
+{
+    static const GLint size = 1;
+    static const GLenum type = GL_FLOAT;
+    static const GLint columns = 1;
+};
+
+template <>
+struct AttributeTraits<glm::vec3>
+{
+    static const GLint size = 3;
+    static const GLenum type = GL_FLOAT;
+    static const GLint columns = 1;
+};
+
+template <>
+struct AttributeTraits<glm::vec4>
+{
+    static const GLint size = 4;
+    static const GLenum type = GL_FLOAT;
+    static const GLint columns = 1;
+};
+
+template <>
+struct AttributeTraits<glm::mat4>
+{
+    static const GLint size = 4;
+    static const GLenum type = GL_FLOAT;
+    static const GLint columns = 4;
+};
+
+// One attribute of a VertexLayout, declare it from the struct member so it
+// follows the struct: VertexAttrib<decltype(Vertex::pos), offsetof(Vertex, pos)>
+template <typename T, size_t Offset, GLboolean Normalized = GL_FALSE>
+struct VertexAttrib
+{
+    typedef T type;
+
+    static constexpr VertexAttribute describe()
+    {
+        return { AttributeTraits<T>::size, AttributeTraits<T>::type, Normalized, Offset };
+    }
+};
+
+namespace detail
+{
+
+constexpr bool all(std::initializer_list<bool> values)
+{
+    for (auto value : values)
+    {
+        if (!value)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+constexpr bool disjoint(std::initializer_list<size_t> offsets, std::initializer_list<size_t> sizes)
+{
+    for (size_t i = 0; i < offsets.size(); i++)
+    {
+        for (size_t j = i + 1; j < offsets.size(); j++)
+        {
+            auto a = offsets.begin()[i], b = offsets.begin()[j];
+            if (a < b + sizes.begin()[j] && b < a + sizes.begin()[i])
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+}
+
+// Compile-time description of the attributes of a vertex struct. Derive from it
+// and add the shader input names:
+//
+//     struct MyLayout : VertexLayout<MyVertex, VertexAttrib<...>, VertexAttrib<...>>
+//     {
+//         static char const *name(size_t index);
+//     };
+//
+// ShaderType::setupAttributes<MyLayout>() then sets up all attribute pointers.
+// Layouts of per-instance data also define a divisor, the number of instances
+// that share one element:
+//
+//         static const GLuint divisor = 1;
+template <typename Vertex, typename... Attributes>
+struct VertexLayout
+{
+    static_assert(std::is_standard_layout<Vertex>::value, "vertex types must be standard layout to be uploaded as they are");
+    static_assert(sizeof...(Attributes) > 0, "a vertex layout needs attributes");
+    static_assert(detail::all({ (Attributes::describe().offset + sizeof(typename Attributes::type) <= sizeof(Vertex))... }),
+                  "vertex attribute outside of the vertex struct");
+    static_assert(detail::disjoint({ Attributes::describe().offset... }, { sizeof(typename Attributes::type)... }),
+                  "vertex attributes overlap");
+
+    static const GLsizei stride = sizeof(Vertex);
+    static const size_t attributeCount = sizeof...(Attributes);
+    static const GLuint divisor = 0;
+
+    static VertexAttribute const *attributes()
+    {
+        static VertexAttribute const attributes[] = { Attributes::describe()... };
+
+        return attributes;
+    }
+
+    static GLint const *columns()
+    {
+        static GLint const columns[] = { AttributeTraits<typename Attributes::type>::columns... };
+
+        return columns;
+    }
+};
+
+// Index of a uniform in the ProgramReflection of one program, -1 for none
+typedef int UniformHandle;
+
+// Active uniforms and attributes of a linked program, queried once after
+// linking and shared by all ShaderType objects that use the program. The last
+// value set on each uniform is kept, so setting the same value again skips the
+// upload. Uniforms that are set with plain glUniform calls make that copy
+// stale, call invalidate() afterwards.
+class ProgramReflection
+{
+    struct Uniform
+    {
+        GLint location;
+        GLenum type;   // type of the setter, GL_INT for bools and samplers
+        size_t offset; // of the last value in _values
+        size_t size;
+        bool known;    // false until the first value is set
+    };
+
+    std::vector<Uniform> _uniforms;
+    std::unordered_map<std::string, UniformHandle> _uniformHandles;
+    std::unordered_map<std::string, GLint> _attributeLocations;
+    std::vector<unsigned char> _values;
+
+    static GLenum setterType(GLenum type)
+    {
+        switch (type)
+        {
+            case GL_BOOL:
+            case GL_SAMPLER_1D:
+            case GL_SAMPLER_2D:
+            case GL_SAMPLER_3D:
+            case GL_SAMPLER_CUBE:
+            case GL_SAMPLER_1D_SHADOW:
+            case GL_SAMPLER_2D_SHADOW:
+            case GL_SAMPLER_CUBE_SHADOW:
+            case GL_SAMPLER_1D_ARRAY:
+            case GL_SAMPLER_2D_ARRAY:
+            case GL_SAMPLER_2D_ARRAY_SHADOW:
+            case GL_SAMPLER_2D_MULTISAMPLE:
+            case GL_SAMPLER_2D_RECT:
+            case GL_SAMPLER_BUFFER:
+            case GL_INT_SAMPLER_2D:
+            case GL_INT_SAMPLER_2D_ARRAY:
+            case GL_UNSIGNED_INT_SAMPLER_2D:
+            case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+                return GL_INT;
+            default:
+                return type;
+        }
+    }
+
+    // Bytes of the value that is kept for a setter type, 0 for types without a setter
+    static size_t valueSize(GLenum type)
+    {
+        switch (type)
+        {
+            case GL_FLOAT: return sizeof(float);
+            case GL_INT: return sizeof(GLint);
+            case GL_FLOAT_VEC3: return sizeof(glm::vec3);
+            case GL_FLOAT_VEC4: return sizeof(glm::vec4);
+            case GL_FLOAT_MAT4: return sizeof(glm::mat4);
+            default: return 0;
+        }
+    }
+
+public:
+    enum Change { Invalid, Unchanged, Changed };
+
+    explicit ProgramReflection(GLuint program)
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> name(static_cast<size_t>((maxLength > 1) ? maxLength : 1));
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(program, GLuint(i), GLsizei(name.size()), &length, &size, &type, &name[0]);
+
+            // Members of uniform blocks have no location
+            auto location = glGetUniformLocation(program, &name[0]);
+            if (location < 0)
+            {
+                continue;
+            }
+
+            // Arrays are reported as "name[0]", they are set through their first element
+            std::string uniformName(&name[0], size_t(length));
+            if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+            {
+                uniformName.resize(uniformName.size() - 3);
+            }
+
+            auto setter = setterType(type);
+            _uniformHandles[uniformName] = UniformHandle(_uniforms.size());
+            _uniforms.push_back(Uniform({ location, setter, _values.size(), valueSize(setter), false }));
+            _values.resize(_values.size() + valueSize(setter));
+        }
+
+        glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+        glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+        name.resize(static_cast<size_t>((maxLength > 1) ? maxLength : 1));
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size;
+            GLenum type;
+            glGetActiveAttrib(program, GLuint(i), GLsizei(name.size()), &length, &size, &type, &name[0]);
+            _attributeLocations[std::string(&name[0], size_t(length))] = glGetAttribLocation(program, &name[0]);
+        }
+    }
+
+    UniformHandle uniform(std::string const &name) const
+    {
+        auto found = _uniformHandles.find(name);
+
+        return found != _uniformHandles.end() ? found->second : -1;
+    }
+
+    GLint uniformLocation(UniformHandle handle) const
+    {
+        return _uniforms[size_t(handle)].location;
+    }
+
+    GLint attributeLocation(std::string const &name) const
+    {
+        auto found = _attributeLocations.find(name);
+
+        return found != _attributeLocations.end() ? found->second : -1;
+    }
+
+    // Keeps the value when it differs from the last one. Invalid for unknown
+    // handles and values of the wrong type.
+    Change change(UniformHandle handle, GLenum type, void const *value)
+    {
+        if (handle < 0 || size_t(handle) >= _uniforms.size() || _uniforms[size_t(handle)].type != type)
+        {
+            return Invalid;
+        }
+
+        auto &uniform = _uniforms[size_t(handle)];
+        auto last = _values.data() + uniform.offset;
+        if (uniform.known && std::memcmp(last, value, uniform.size) == 0)
+        {
+            return Unchanged;
+        }
+
+        std::memcpy(last, value, uniform.size);
+        uniform.known = true;
+
+        return Changed;
+    }
+
+    // Forgets the last values, the next value set on each uniform is uploaded
+    void invalidate()
+    {
+        for (auto &uniform : _uniforms)
+        {
+            uniform.known = false;
+        }
+    }
+};
+
+// How the programs of ShaderType::compile() were created, since the start of
+// the application
+struct ProgramCacheStats
+{
+    size_t shared;       // already linked by another ShaderType
+    size_t binaryHits;   // loaded from a program binary on disk
+    size_t binaryMisses; // no usable program binary, compiled and linked
+};
+
+// Linked programs by the hash of their sources, so ShaderType objects that
+// compile the same sources share one program and it is compiled and linked
+// only once. Each ShaderType that gets a program holds a reference to it,
+// ShaderType::cleanup() gives it back and the last one deletes the program.
+//
+// With setBinaryDirectory() the linked programs are also stored on disk with
+// glGetProgramBinary and loaded from there on the next start, as long as the
+// sources, GL_RENDERER and GL_VERSION are the same.
+class ProgramCache
+{
+    struct Entry
+    {
+        std::string sources;
+        GLuint program;
+        int references;
+        std::shared_ptr<ProgramReflection> reflection;
+    };
+
+    std::unordered_map<uint64_t, Entry> _entries;
+
+    // Hash of each cached program, to find its entry on release
+    std::unordered_map<GLuint, uint64_t> _hashes;
+
+    // Programs whose hash collided with a cached one, by program
+    std::unordered_map<GLuint, Entry> _uncached;
+
+    std::string _binaryDirectory;
+    std::string _driver;
+    ProgramCacheStats _stats;
+
+    // Tags the start of a program binary file
+    static const uint32_t BinaryMagic = 0x42504c47; // "GLPB"
+
+    // Binaries only load into the driver that wrote them, so the driver is part of the key
+    uint64_t binaryKey(std::string const &sources)
+    {
+        if (_driver.empty())
+        {
+            _driver = std::string(reinterpret_cast<const char *>(glGetString(GL_RENDERER))) + '\0' +
+                      std::string(reinterpret_cast<const char *>(glGetString(GL_VERSION)));
+        }
+
+        return hash(sources + '\0' + _driver);
+    }
+
+    std::string binaryPath(uint64_t key) const
+    {
+        static const char digits[] = "0123456789abcdef";
+
+        std::string name(16, '0');
+        for (int i = 15; i >= 0; i--, key >>= 4)
+        {
+            name[size_t(i)] = digits[key & 0xf];
+        }
+
+        return _binaryDirectory + "/" + name + ".bin";
+    }
+
+public:
+    ProgramCache()
+        : _stats({ 0, 0, 0 })
+    { }
+
+    // Directory to store program binaries in, it must exist. An empty path,
+    // the default, turns the disk cache off. Needs GL_ARB_get_program_binary.
+    void setBinaryDirectory(std::string const &directory)
+    {
+        _binaryDirectory = directory;
+    }
+
+    bool storesBinaries() const
+    {
+        if (_binaryDirectory.empty() || !GLAD_GL_ARB_get_program_binary)
+        {
+            return false;
+        }
+
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+        return formats > 0;
+    }
+
+    // Creates a program from the binary stored for these sources, 0 when there
+    // is none or the driver rejects it
+    GLuint loadBinary(std::string const &sources)
+    {
+        if (!storesBinaries())
+        {
+            _stats.binaryMisses++;
+            return 0;
+        }
+
+        auto key = binaryKey(sources);
+        std::ifstream file(binaryPath(key), std::ios::binary);
+
+        uint32_t magic = 0;
+        uint64_t fileKey = 0;
+        GLenum format = 0;
+        file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+        file.read(reinterpret_cast<char *>(&fileKey), sizeof(fileKey));
+        file.read(reinterpret_cast<char *>(&format), sizeof(format));
+
+        std::vector<char> binary;
+        if (file && magic == BinaryMagic && fileKey == key)
+        {
+            binary.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+
+        if (binary.empty())
+        {
+            _stats.binaryMisses++;
+            return 0;
+        }
+
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, format, binary.data(), GLsizei(binary.size()));
+
+        // Fails after a driver update changed the binary format
+        GLint result = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &result);
+        if (result == GL_FALSE)
+        {
+            glDeleteProgram(program);
+            _stats.binaryMisses++;
+            return 0;
+        }
+
+        _stats.binaryHits++;
+
+        return program;
+    }
+
+    // Writes the binary of a program that was just linked from these sources
+    void saveBinary(std::string const &sources, GLuint program)
+    {
+        if (!storesBinaries())
+        {
+            return;
+        }
+
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+        {
+            return;
+        }
+
+        std::vector<char> binary(static_cast<size_t>(length));
+        GLenum format = 0;
+        glGetProgramBinary(program, length, &length, &format, binary.data());
+
+        auto key = binaryKey(sources);
+        uint32_t magic = BinaryMagic;
+        std::ofstream file(binaryPath(key), std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&magic), sizeof(magic));
+        file.write(reinterpret_cast<const char *>(&key), sizeof(key));
+        file.write(reinterpret_cast<const char *>(&format), sizeof(format));
+        file.write(binary.data(), length);
+        if (!file)
+        {
+            std::cout << "could not write program binary " << binaryPath(key) << std::endl;
+        }
+    }
+
+    ProgramCacheStats const &stats() const
+    {
+        return _stats;
+    }
+
+    // Prints the stats, call it at the end of startup
+    void report() const
+    {
+        std::cout << "programs: " << _stats.binaryHits << " from disk, "
+                  << _stats.binaryMisses << " compiled, "
+                  << _stats.shared << " shared" << std::endl;
+    }
+
+    // 64 bit FNV-1a
+    static uint64_t hash(std::string const &sources)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (auto c : sources)
+        {
+            h = (h ^ uint64_t(static_cast<unsigned char>(c))) * 1099511628211ull;
+        }
+
+        return h;
+    }
+
+    // Takes a reference to the program linked from these sources, 0 when there is none yet
+    GLuint acquire(std::string const &sources)
+    {
+        auto found = _entries.find(hash(sources));
+        if (found == _entries.end() || found->second.sources != sources)
+        {
+            return 0;
+        }
+
+        found->second.references++;
+        _stats.shared++;
+
+        return found->second.program;
+    }
+
+    // Adds a program that was just linked, with one reference. A program whose
+    // hash collides with a different cached one is not found by acquire(), but
+    // its references are counted all the same.
+    void add(std::string const &sources, GLuint program)
+    {
+        auto h = hash(sources);
+        if (_entries.count(h) == 0)
+        {
+            _entries[h] = Entry({ sources, program, 1, nullptr });
+            _hashes[program] = h;
+        }
+        else
+        {
+            _uncached[program] = Entry({ sources, program, 1, nullptr });
+        }
+    }
+
+    // Takes another reference to a program that was added
+    void retain(GLuint program)
+    {
+        auto found = _hashes.find(program);
+        if (found == _hashes.end())
+        {
+            _uncached[program].references++;
+            return;
+        }
+
+        _entries[found->second].references++;
+        _stats.shared++;
+    }
+
+    void release(GLuint program)
+    {
+        auto found = _hashes.find(program);
+        if (found == _hashes.end())
+        {
+            auto uncached = _uncached.find(program);
+            if (uncached != _uncached.end() && --uncached->second.references > 0)
+            {
+                return;
+            }
+
+            if (uncached != _uncached.end())
+            {
+                _uncached.erase(uncached);
+            }
+            stateCache().deleteProgram(program);
+            return;
+        }
+
+        auto &entry = _entries[found->second];
+        if (--entry.references == 0)
+        {
+            _entries.erase(found->second);
+            _hashes.erase(found);
+            stateCache().deleteProgram(program);
+        }
+    }
+
+    // Queries the uniforms and attributes of a program once, programs that were
+    // never added get their own
+    std::shared_ptr<ProgramReflection> reflection(GLuint program)
+    {
+        Entry *entry = nullptr;
+
+        auto found = _hashes.find(program);
+        if (found != _hashes.end())
+        {
+            entry = &_entries[found->second];
+        }
+        else
+        {
+            auto uncached = _uncached.find(program);
+            if (uncached == _uncached.end())
+            {
+                return std::make_shared<ProgramReflection>(program);
+            }
+            entry = &uncached->second;
+        }
+
+        if (entry->reflection == nullptr)
+        {
+            entry->reflection = std::make_shared<ProgramReflection>(program);
+        }
+
+        return entry->reflection;
+    }
+
+    size_t size() const
+    {
+        return _entries.size();
+    }
+};
+
+// The program cache of the GL context
+inline ProgramCache &programCache()
+{
+    static ProgramCache cache;
+
+    return cache;
+}
+
 class ShaderType
 {
     GLuint _shaderId;
-    GLuint _matrixUniformId;
+    UniformHandle _matrixUniform;
 
     std::string _matrixUniformName;
     std::string _vertexAttributeName;
     std::string _colorAttributeName;
 
+    // Uniforms and attributes of the program, shared with other ShaderType
+    // objects that use the same program
+    std::shared_ptr<ProgramReflection> _reflection;
+
+    void setupAttribute(GLint location, GLsizei stride, VertexAttribute const &attribute) const
+    {
+        // Attributes the shader does not use have no location
+        if (location < 0)
+        {
+            return;
+        }
+
+        glVertexAttribPointer(GLuint(location), attribute.size, attribute.type, attribute.normalized, stride, reinterpret_cast<const GLvoid*>(attribute.offset));
+        glEnableVertexAttribArray(GLuint(location));
+    }
+
+    static std::string insertDefines(std::string const &source, std::string const &defines)
+    {
+        if (defines.empty())
+        {
+            return source;
+        }
+
+        // #version has to stay the first line
+        size_t line = 0;
+        if (source.compare(0, 8, "#version") == 0)
+        {
+            line = source.find('\n');
+            line = (line == std::string::npos) ? source.size() : line + 1;
+        }
+
+        auto result = source;
+        result.insert(line, defines.back() == '\n' ? defines : defines + '\n');
+
+        return result;
+    }
+
+    // Compiles and links without waiting for the driver, finishLink() checks
+    // the result
+    static GLuint startLink(std::string const &vertSource, std::string const &fragSource)
+    {
+        GLuint program = glCreateProgram();
+
+        GLenum const types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+        std::string const *sources[] = { &vertSource, &fragSource };
+        for (int i = 0; i < 2; i++)
+        {
+            GLuint shader = glCreateShader(types[i]);
+            const char *shaderSrc = sources[i]->c_str();
+            glShaderSource(shader, 1, &shaderSrc, NULL);
+            glCompileShader(shader);
+            glAttachShader(program, shader);
+
+            // Only flagged, the shader lives until it is detached from the program
+            glDeleteShader(shader);
+        }
+
+        if (programCache().storesBinaries())
+        {
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glLinkProgram(program);
+
+        return program;
+    }
+
+    // Waits for the link to finish. Returns false after printing the compile or
+    // link log and deleting the program.
+    static bool finishLink(GLuint program)
+    {
+        GLint result = GL_FALSE;
+        GLint logLength;
+
+        glGetProgramiv(program, GL_LINK_STATUS, &result);
+
+        GLuint shaders[2];
+        GLsizei shaderCount = 0;
+        glGetAttachedShaders(program, 2, &shaderCount, shaders);
+
+        if (result == GL_FALSE)
+        {
+            bool compiled = true;
+            for (GLsizei i = 0; i < shaderCount; i++)
+            {
+                glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &result);
+                if (result == GL_FALSE)
+                {
+                    glGetShaderiv(shaders[i], GL_INFO_LOG_LENGTH, &logLength);
+                    std::vector<char> shaderError(static_cast<size_t>((logLength > 1) ? logLength : 1));
+                    glGetShaderInfoLog(shaders[i], logLength, NULL, &shaderError[0]);
+                    std::cout << &shaderError[0] << std::endl;
+                    compiled = false;
+                }
+            }
+
+            if (compiled)
+            {
+                glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+                std::vector<char> programError(static_cast<size_t>((logLength > 1) ? logLength : 1));
+                glGetProgramInfoLog(program, logLength, NULL, &programError[0]);
+                std::cout << &programError[0] << std::endl;
+            }
+
+            glDeleteProgram(program);
+
+            return false;
+        }
+
+        // Frees the shaders, the linked program does not need them anymore
+        for (GLsizei i = 0; i < shaderCount; i++)
+        {
+            glDetachShader(program, shaders[i]);
+        }
+
+        return true;
+    }
+
+    // Takes over a program that holds a reference in programCache()
+    void setProgram(GLuint program)
+    {
+        _shaderId = program;
+
+        _reflection = programCache().reflection(program);
+        _matrixUniform = _reflection->uniform(_matrixUniformName);
+    }
+
+    // Uploads only when the value changed, the program must be in use
+    bool setUniform(UniformHandle handle, GLenum type, void const *value) const
+    {
+        if (_reflection == nullptr)
+        {
+            return false;
+        }
+
+        auto change = _reflection->change(handle, type, value);
+        if (change != ProgramReflection::Changed)
+        {
+            return change == ProgramReflection::Unchanged;
+        }
+
+        auto location = _reflection->uniformLocation(handle);
+        switch (type)
+        {
+            case GL_FLOAT: glUniform1fv(location, 1, static_cast<const GLfloat*>(value)); break;
+            case GL_INT: glUniform1iv(location, 1, static_cast<const GLint*>(value)); break;
+            case GL_FLOAT_VEC3: glUniform3fv(location, 1, static_cast<const GLfloat*>(value)); break;
+            case GL_FLOAT_VEC4: glUniform4fv(location, 1, static_cast<const GLfloat*>(value)); break;
+            case GL_FLOAT_MAT4: glUniformMatrix4fv(location, 1, GL_FALSE, static_cast<const GLfloat*>(value)); break;
+        }
+
+        return true;
+    }
+
+    friend class ShaderCompiler;
+
 public:
     ShaderType()
-        : _shaderId(0), _matrixUniformId(0),
+        : _shaderId(0), _matrixUniform(-1),
           _matrixUniformName("u_matrix"),
           _vertexAttributeName("vertex"), _colorAttributeName("color")
     { }
 
+    // A copy takes its own reference to the program, so the copy and the
+    // original each call cleanup() once
+    ShaderType(ShaderType const &other)
+        : _shaderId(other._shaderId), _matrixUniform(other._matrixUniform),
+          _matrixUniformName(other._matrixUniformName),
+          _vertexAttributeName(other._vertexAttributeName), _colorAttributeName(other._colorAttributeName),
+          _reflection(other._reflection)
+    {
+        if (_shaderId != 0)
+        {
+            programCache().retain(_shaderId);
+        }
+    }
+
+    // Moving hands over the reference, the moved-from object has no program
+    ShaderType(ShaderType &&other) noexcept
+        : _shaderId(other._shaderId), _matrixUniform(other._matrixUniform),
+          _matrixUniformName(std::move(other._matrixUniformName)),
+          _vertexAttributeName(std::move(other._vertexAttributeName)), _colorAttributeName(std::move(other._colorAttributeName)),
+          _reflection(std::move(other._reflection))
+    {
+        other._shaderId = 0;
+        other._matrixUniform = -1;
+    }
+
+    ShaderType &operator = (ShaderType const &other)
+    {
+        if (this != &other)
+        {
+            // Retain first, other may share this program
+            if (other._shaderId != 0)
+            {
+                programCache().retain(other._shaderId);
+            }
+            cleanup();
+
+            _shaderId = other._shaderId;
+            _matrixUniform = other._matrixUniform;
+            _matrixUniformName = other._matrixUniformName;
+            _vertexAttributeName = other._vertexAttributeName;
+            _colorAttributeName = other._colorAttributeName;
+            _reflection = other._reflection;
+        }
+
+        return *this;
+    }
+
+    ShaderType &operator = (ShaderType &&other) noexcept
+    {
+        if (this != &other)
+        {
+            cleanup();
+
+            _shaderId = other._shaderId;
+            _matrixUniform = other._matrixUniform;
+            _matrixUniformName = std::move(other._matrixUniformName);
+            _vertexAttributeName = std::move(other._vertexAttributeName);
+            _colorAttributeName = std::move(other._colorAttributeName);
+            _reflection = std::move(other._reflection);
+
+            other._shaderId = 0;
+            other._matrixUniform = -1;
+        }
+
+        return *this;
+    }
+
     virtual ~ShaderType() { }
 
     GLuint id() const
@@ -30,141 +895,428 @@ public:
 
     void use() const
     {
-        glUseProgram(_shaderId);
+        stateCache().useProgram(_shaderId);
     }
 
     bool compileDefaultShader()
     {
-        static GLuint defaultShader = 0;
+        std::string const vshader(
+                    "#version 150\n"
 
-        if (defaultShader == 0)
-        {
-            std::string const vshader(
-                        "#version 150\n"
+                    "in vec3 vertex;"
+                    "in vec4 color;"
+
+                    "uniform mat4 u_matrix;"
+
+                    "out vec4 f_color;"
+
+                    "void main()"
+                    "{"
+                    "    gl_Position = u_matrix * vec4(vertex.xyz, 1.0);"
+                    "    f_color = color;"
+                    "}"
+                    );
+
+        std::string const fshader(
+                    "#version 150\n"
+
+                    "in vec4 f_color;"
+                    "out vec4 color;"
+
+                    "void main()"
+                    "{"
+                    "   color = f_color;"
+                    "}"
+                    );
+
+        return compile(vshader, fshader);
+    }
+
+    // Same as the default shader, with a model matrix and a color tint per
+    // instance. Use it with BufferType::setupInstances() and renderInstanced().
+    bool compileDefaultInstancedShader()
+    {
+        std::string const vshader(
+                    "#version 150\n"
 
-                        "in vec3 vertex;"
-                        "in vec4 color;"
+                    "in vec3 vertex;"
+                    "in vec4 color;"
+                    "in mat4 model;"
+                    "in vec4 tint;"
 
-                        "uniform mat4 u_matrix;"
+                    "uniform mat4 u_matrix;"
 
-                        "out vec4 f_color;"
+                    "out vec4 f_color;"
 
-                        "void main()"
-                        "{"
-                        "    gl_Position = u_matrix * vec4(vertex.xyz, 1.0);"
-                        "    f_color = color;"
-                        "}"
-                        );
+                    "void main()"
+                    "{"
+                    "    gl_Position = u_matrix * model * vec4(vertex.xyz, 1.0);"
+                    "    f_color = color * tint;"
+                    "}"
+                    );
 
-            std::string const fshader(
-                        "#version 150\n"
+        std::string const fshader(
+                    "#version 150\n"
 
-                        "in vec4 f_color;"
-                        "out vec4 color;"
+                    "in vec4 f_color;"
+                    "out vec4 color;"
 
-                        "void main()"
-                        "{"
-                        "   color = f_color;"
-                        "}"
-                        );
+                    "void main()"
+                    "{"
+                    "   color = f_color;"
+                    "}"
+                    );
 
-            if (compile(vshader, fshader))
+        return compile(vshader, fshader);
+    }
+
+    virtual bool compile(std::string const &vertShaderStr, std::string const &fragShaderStr)
+    {
+        return compile(vertShaderStr, fragShaderStr, std::string());
+    }
+
+    // Defines are lines like "#define SHADOWS 1\n" that go after the #version
+    // line of both shaders. Sources that were compiled before, by this or any
+    // other ShaderType, reuse the program from programCache().
+    bool compile(std::string const &vertShaderStr, std::string const &fragShaderStr, std::string const &defines)
+    {
+        auto vertSource = insertDefines(vertShaderStr, defines);
+        auto fragSource = insertDefines(fragShaderStr, defines);
+        auto sources = vertSource + '\0' + fragSource;
+
+        cleanup();
+
+        auto program = programCache().acquire(sources);
+        if (program == 0)
+        {
+            program = programCache().loadBinary(sources);
+            if (program == 0)
             {
-                defaultShader = _shaderId;
+                program = startLink(vertSource, fragSource);
+                if (!finishLink(program))
+                {
+                    return false;
+                }
 
-                return true;
+                programCache().saveBinary(sources, program);
             }
 
-            return false;
+            programCache().add(sources, program);
         }
 
+        setProgram(program);
+
         return true;
     }
 
-    virtual bool compile(std::string const &vertShaderStr, std::string const &fragShaderStr)
+    // Gives the program back to programCache(), it is deleted when no other
+    // ShaderType uses it anymore
+    void cleanup()
     {
-        GLuint vertShader = glCreateShader(GL_VERTEX_SHADER);
-        GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
-        const char *vertShaderSrc = vertShaderStr.c_str();
-        const char *fragShaderSrc = fragShaderStr.c_str();
+        if (_shaderId != 0)
+        {
+            programCache().release(_shaderId);
+            _shaderId = 0;
+        }
+        _reflection = nullptr;
+        _matrixUniform = -1;
+    }
 
-        GLint result = GL_FALSE;
-        GLint logLength;
+    void setupMatrices(glm::mat4 const &matrix)
+    {
+        use();
 
-        // Compile vertex shader
-        glShaderSource(vertShader, 1, &vertShaderSrc, NULL);
-        glCompileShader(vertShader);
+        setMatrix(matrix);
+    }
 
-        // Check vertex shader
-        glGetShaderiv(vertShader, GL_COMPILE_STATUS, &result);
-        if (result == GL_FALSE)
+    // Same without selecting the program, it must already be in use
+    void setMatrix(glm::mat4 const &matrix) const
+    {
+        setUniform(_matrixUniform, matrix);
+    }
+
+    // Handle of a uniform for the setters, -1 when the program has no active
+    // uniform with this name. Look handles up once after compile(), they are
+    // only valid for this program.
+    UniformHandle uniform(std::string const &name) const
+    {
+        return _reflection != nullptr ? _reflection->uniform(name) : -1;
+    }
+
+    // The setters need the program in use and skip the upload when the
+    // uniform already has the value. They return false for unknown handles
+    // and for values of the wrong type. Bools and samplers are set as GLint.
+    bool setUniform(UniformHandle handle, float value) const
+    {
+        return setUniform(handle, GL_FLOAT, &value);
+    }
+
+    bool setUniform(UniformHandle handle, GLint value) const
+    {
+        return setUniform(handle, GL_INT, &value);
+    }
+
+    bool setUniform(UniformHandle handle, glm::vec3 const &value) const
+    {
+        return setUniform(handle, GL_FLOAT_VEC3, value.data);
+    }
+
+    bool setUniform(UniformHandle handle, glm::vec4 const &value) const
+    {
+        return setUniform(handle, GL_FLOAT_VEC4, value.data);
+    }
+
+    bool setUniform(UniformHandle handle, glm::mat4 const &value) const
+    {
+        return setUniform(handle, GL_FLOAT_MAT4, glm::value_ptr(value));
+    }
+
+    // After setting uniforms of this program with plain glUniform calls
+    void invalidateUniforms() const
+    {
+        if (_reflection != nullptr)
         {
-            glGetShaderiv(vertShader, GL_INFO_LOG_LENGTH, &logLength);
-            std::vector<char> vertShaderError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-            glGetShaderInfoLog(vertShader, logLength, NULL, &vertShaderError[0]);
-            std::cout << &vertShaderError[0] << std::endl;
+            _reflection->invalidate();
+        }
+    }
 
+    // Connects a uniform block of the program to a binding point of
+    // UniformBuffer or UniformRing, false when the program has no such block
+    bool bindUniformBlock(std::string const &name, GLuint binding) const
+    {
+        auto index = glGetUniformBlockIndex(_shaderId, name.c_str());
+        if (index == GL_INVALID_INDEX)
+        {
             return false;
         }
 
-        // Compile fragment shader
-        glShaderSource(fragShader, 1, &fragShaderSrc, NULL);
-        glCompileShader(fragShader);
+        glUniformBlockBinding(_shaderId, index, binding);
 
-        // Check fragment shader
-        glGetShaderiv(fragShader, GL_COMPILE_STATUS, &result);
-        if (result == GL_FALSE)
+        return true;
+    }
+
+    // -1 when the program has no active attribute with this name
+    GLint attributeLocation(std::string const &name) const
+    {
+        return _reflection != nullptr ? _reflection->attributeLocation(name) : -1;
+    }
+
+    // Sets up the attributes of the bound VAO from a VertexLayout
+    template <typename Layout>
+    void setupAttributes() const
+    {
+        auto attributes = Layout::attributes();
+        auto columns = Layout::columns();
+        for (size_t i = 0; i < Layout::attributeCount; i++)
         {
-            glGetShaderiv(fragShader, GL_INFO_LOG_LENGTH, &logLength);
-            std::vector<char> fragShaderError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-            glGetShaderInfoLog(fragShader, logLength, NULL, &fragShaderError[0]);
-            std::cout << &fragShaderError[0] << std::endl;
+            auto location = attributeLocation(Layout::name(i));
+            if (location < 0)
+            {
+                continue;
+            }
 
-            return false;
+            // Matrix columns follow each other, in locations and in memory
+            auto column = attributes[i];
+            for (GLint c = 0; c < columns[i]; c++)
+            {
+                setupAttribute(location + c, Layout::stride, column);
+                glVertexAttribDivisor(GLuint(location + c), Layout::divisor);
+                column.offset += size_t(column.size) * sizeof(float);
+            }
         }
+    }
 
-        _shaderId = glCreateProgram();
-        glAttachShader(_shaderId, vertShader);
-        glAttachShader(_shaderId, fragShader);
-        glLinkProgram(_shaderId);
+    void setupAttributes(VertexFormat const &format) const
+    {
+        setupPositionAttribute(format.stride, format.position);
+        setupColorAttribute(format.stride, format.color);
+    }
 
-        glGetProgramiv(_shaderId, GL_LINK_STATUS, &result);
-        if (result == GL_FALSE)
+    // One attribute at a time, for attributes that are read from different buffers
+    void setupPositionAttribute(GLsizei stride, VertexAttribute const &attribute) const
+    {
+        setupAttribute(attributeLocation(_vertexAttributeName), stride, attribute);
+    }
+
+    void setupColorAttribute(GLsizei stride, VertexAttribute const &attribute) const
+    {
+        setupAttribute(attributeLocation(_colorAttributeName), stride, attribute);
+    }
+
+    // Float positions and colors
+    void setupAttributes(GLsizei stride, size_t positionOffset, size_t colorOffset) const
+    {
+        VertexFormat format = {
+            stride,
+            { sizeof(glm::vec3) / sizeof(float), GL_FLOAT, GL_FALSE, positionOffset },
+            { sizeof(glm::vec4) / sizeof(float), GL_FLOAT, GL_FALSE, colorOffset }
+        };
+
+        setupAttributes(format);
+    }
+};
+
+// Result of ShaderCompiler::submit(), shared with the compiler
+class ShaderFuture
+{
+    enum State { Pending, Ready, Failed };
+
+    std::shared_ptr<State> _state;
+
+    explicit ShaderFuture(State state)
+        : _state(std::make_shared<State>(state))
+    { }
+
+    friend class ShaderCompiler;
+
+public:
+    // True once the ShaderType has its program, or failed to get one
+    bool ready() const
+    {
+        return *_state != Pending;
+    }
+
+    bool succeeded() const
+    {
+        return *_state == Ready;
+    }
+};
+
+// Compiles many programs at once. submit() hands the sources of all programs
+// to the driver without waiting for any of them, poll() then picks up the
+// programs that are done, so the driver can compile them in parallel while the
+// application loads the rest. With GL_KHR_parallel_shader_compile or
+// GL_ARB_parallel_shader_compile poll() never blocks, without them it waits
+// for all submitted programs. Programs go through programCache() like
+// ShaderType::compile() does. All calls must be made on the GL thread, and the
+// ShaderType objects must stay alive until their future is ready.
+class ShaderCompiler
+{
+    struct Job
+    {
+        std::string sources;
+        GLuint program;
+        std::vector<std::pair<ShaderType *, ShaderFuture>> shaders;
+    };
+
+    std::vector<Job> _jobs;
+
+    static bool canPoll()
+    {
+        return GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile;
+    }
+
+    static void finish(Job &job)
+    {
+        bool linked = ShaderType::finishLink(job.program);
+        if (linked)
         {
-            glGetProgramiv(_shaderId, GL_INFO_LOG_LENGTH, &logLength);
-            std::vector<char> programError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-            glGetProgramInfoLog(_shaderId, logLength, NULL, &programError[0]);
-            std::cout << &programError[0] << std::endl;
+            programCache().saveBinary(job.sources, job.program);
+            programCache().add(job.sources, job.program);
+        }
 
-            return false;
+        // The first shader takes the reference of add(), the others their own.
+        // retain() rather than acquire(), which does not find a program whose
+        // hash collided with another one.
+        for (size_t i = 0; i < job.shaders.size(); i++)
+        {
+            auto &shader = job.shaders[i];
+            if (!linked)
+            {
+                *shader.second._state = ShaderFuture::Failed;
+                continue;
+            }
+
+            if (i > 0)
+            {
+                programCache().retain(job.program);
+            }
+            shader.first->setProgram(job.program);
+            *shader.second._state = ShaderFuture::Ready;
         }
+    }
 
-        glDeleteShader(vertShader);
-        glDeleteShader(fragShader);
+public:
+    virtual ~ShaderCompiler() { }
+
+    ShaderFuture submit(ShaderType &shader, std::string const &vertShaderStr, std::string const &fragShaderStr, std::string const &defines = std::string())
+    {
+        auto vertSource = ShaderType::insertDefines(vertShaderStr, defines);
+        auto fragSource = ShaderType::insertDefines(fragShaderStr, defines);
+        auto sources = vertSource + '\0' + fragSource;
 
-        _matrixUniformId = glGetUniformLocation(_shaderId, _matrixUniformName.c_str());
+        shader.cleanup();
 
-        return true;
+        auto program = programCache().acquire(sources);
+        if (program == 0)
+        {
+            // Sources that are already on their way are compiled only once
+            for (auto &job : _jobs)
+            {
+                if (job.sources == sources)
+                {
+                    ShaderFuture future(ShaderFuture::Pending);
+                    job.shaders.push_back(std::make_pair(&shader, future));
+
+                    return future;
+                }
+            }
+
+            program = programCache().loadBinary(sources);
+            if (program == 0)
+            {
+                ShaderFuture future(ShaderFuture::Pending);
+                _jobs.push_back(Job({ sources, ShaderType::startLink(vertSource, fragSource), { std::make_pair(&shader, future) } }));
+
+                return future;
+            }
+
+            programCache().add(sources, program);
+        }
+
+        shader.setProgram(program);
+
+        return ShaderFuture(ShaderFuture::Ready);
     }
 
-    void setupMatrices(glm::mat4 const &matrix)
+    // Finishes the programs that are done, returns how many are still pending
+    size_t poll()
     {
-        use();
+        if (!canPoll())
+        {
+            wait();
+            return 0;
+        }
 
-        glUniformMatrix4fv(_matrixUniformId, 1, false, glm::value_ptr(matrix));
+        auto done = std::stable_partition(_jobs.begin(), _jobs.end(), [] (Job const &job) {
+            GLint completed = GL_FALSE;
+            glGetProgramiv(job.program, GL_COMPLETION_STATUS_KHR, &completed);
+
+            return completed == GL_FALSE;
+        });
+
+        for (auto job = done; job != _jobs.end(); ++job)
+        {
+            finish(*job);
+        }
+        _jobs.erase(done, _jobs.end());
+
+        return _jobs.size();
     }
 
-    void setupAttributes() const
+    // Finishes all programs, blocking until the driver is done with them
+    void wait()
     {
-        auto vertexSize = sizeof(glm::vec3) + sizeof(glm::vec4);
-
-        auto vertexAttrib = glGetAttribLocation(_shaderId, _vertexAttributeName.c_str());
-        glVertexAttribPointer(GLuint(vertexAttrib), sizeof(glm::vec3) / sizeof(float), GL_FLOAT, GL_FALSE, vertexSize, 0);
-        glEnableVertexAttribArray(GLuint(vertexAttrib));
+        for (auto &job : _jobs)
+        {
+            finish(job);
+        }
+        _jobs.clear();
+    }
 
-        auto colorAttrib = glGetAttribLocation(_shaderId, _colorAttributeName.c_str());
-        glVertexAttribPointer(GLuint(colorAttrib), sizeof(glm::vec4) / sizeof(float), GL_FLOAT, GL_FALSE, vertexSize, reinterpret_cast<const GLvoid*>(sizeof(glm::vec3)));
-        glEnableVertexAttribArray(GLuint(colorAttrib));
+    size_t pending() const
+    {
+        return _jobs.size();
     }
 };
 
@@ -0,0 +1,295 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include "glad/glad.h"
+#include <cstddef>
+#include <initializer_list>
+
+// How many GL calls went through the state cache and how many were dropped
+// because they would not have changed anything
+struct StateCounters
+{
+    size_t issued;
+    size_t skipped;
+};
+
+// Shadow copy of the GL bindings and render state that glshader.h, glbuffer.h
+// and glbatch.h change. Calls that would set what is already set are skipped.
+// There is one cache for the one GL context of the application. Code that
+// changes this state with plain GL calls must call invalidate() afterwards.
+class StateCache
+{
+    // Value of state that has not been set through the cache yet
+    static const GLuint Unknown = 0xffffffffu;
+
+    // Indexed uniform buffer bindings that are cached, higher ones go straight to GL
+    static const GLuint UniformBindings = 16;
+
+    // Size 0 is a glBindBufferBase() of the whole buffer
+    struct Range
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    GLuint _program;
+    GLuint _vertexArray;
+    GLuint _arrayBuffer;
+    GLuint _elementBuffer;
+    GLuint _indirectBuffer;
+    GLuint _uniformBuffer;
+    Range _uniformRanges[UniformBindings];
+    GLuint _blend;
+    GLuint _blendSource;
+    GLuint _blendDestination;
+    GLuint _depthTest;
+    GLuint _depthFunc;
+    GLuint _depthMask;
+
+    StateCounters _counters;
+
+    // Returns true when the GL call has to be made
+    bool change(GLuint &current, GLuint value)
+    {
+        if (current == value)
+        {
+            _counters.skipped++;
+            return false;
+        }
+
+        current = value;
+        _counters.issued++;
+        return true;
+    }
+
+    GLuint *bufferBinding(GLenum target)
+    {
+        switch (target)
+        {
+            case GL_ARRAY_BUFFER: return &_arrayBuffer;
+            case GL_ELEMENT_ARRAY_BUFFER: return &_elementBuffer;
+            case GL_DRAW_INDIRECT_BUFFER: return &_indirectBuffer;
+            case GL_UNIFORM_BUFFER: return &_uniformBuffer;
+            default: return nullptr;
+        }
+    }
+
+    GLuint *capability(GLenum cap)
+    {
+        switch (cap)
+        {
+            case GL_BLEND: return &_blend;
+            case GL_DEPTH_TEST: return &_depthTest;
+            default: return nullptr;
+        }
+    }
+
+public:
+    StateCache()
+        : _counters({ 0, 0 })
+    {
+        invalidate();
+    }
+
+    // Forgets everything, the next call for each state goes to GL
+    void invalidate()
+    {
+        _program = _vertexArray = _arrayBuffer = _elementBuffer = _indirectBuffer = _uniformBuffer = Unknown;
+        for (auto &range : _uniformRanges)
+        {
+            range = { Unknown, 0, 0 };
+        }
+        _blend = _blendSource = _blendDestination = Unknown;
+        _depthTest = _depthFunc = _depthMask = Unknown;
+    }
+
+    void useProgram(GLuint program)
+    {
+        if (change(_program, program))
+        {
+            glUseProgram(program);
+        }
+    }
+
+    void bindVertexArray(GLuint vertexArray)
+    {
+        if (change(_vertexArray, vertexArray))
+        {
+            glBindVertexArray(vertexArray);
+
+            // The element buffer binding is part of the vertex array
+            _elementBuffer = Unknown;
+        }
+    }
+
+    void bindBuffer(GLenum target, GLuint buffer)
+    {
+        auto binding = bufferBinding(target);
+        if (binding == nullptr)
+        {
+            _counters.issued++;
+            glBindBuffer(target, buffer);
+        }
+        else if (change(*binding, buffer))
+        {
+            glBindBuffer(target, buffer);
+        }
+    }
+
+    // Binds a range of a uniform buffer to a binding point. Like GL, this also
+    // binds the buffer to the target itself.
+    void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        if (target == GL_UNIFORM_BUFFER && index < UniformBindings)
+        {
+            auto &range = _uniformRanges[index];
+            if (range.buffer == buffer && range.offset == offset && range.size == size)
+            {
+                _counters.skipped++;
+                return;
+            }
+
+            range = { buffer, offset, size };
+        }
+
+        auto binding = bufferBinding(target);
+        if (binding != nullptr)
+        {
+            *binding = buffer;
+        }
+
+        _counters.issued++;
+        if (size == 0)
+        {
+            glBindBufferBase(target, index, buffer);
+        }
+        else
+        {
+            glBindBufferRange(target, index, buffer, offset, size);
+        }
+    }
+
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+    {
+        bindBufferRange(target, index, buffer, 0, 0);
+    }
+
+    // GL_BLEND and GL_DEPTH_TEST are cached, other capabilities go straight to GL
+    void setEnabled(GLenum cap, bool enabled)
+    {
+        auto current = capability(cap);
+        if (current != nullptr && !change(*current, enabled ? 1 : 0))
+        {
+            return;
+        }
+        if (current == nullptr)
+        {
+            _counters.issued++;
+        }
+
+        if (enabled)
+        {
+            glEnable(cap);
+        }
+        else
+        {
+            glDisable(cap);
+        }
+    }
+
+    void blendFunc(GLenum source, GLenum destination)
+    {
+        // Both change or neither, so only count one call
+        if (_blendSource == source && _blendDestination == destination)
+        {
+            _counters.skipped++;
+            return;
+        }
+
+        _blendSource = source;
+        _blendDestination = destination;
+        _counters.issued++;
+        glBlendFunc(source, destination);
+    }
+
+    void depthFunc(GLenum func)
+    {
+        if (change(_depthFunc, func))
+        {
+            glDepthFunc(func);
+        }
+    }
+
+    void depthMask(bool write)
+    {
+        if (change(_depthMask, write ? 1 : 0))
+        {
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+        }
+    }
+
+    // Deleting an object that is bound resets its binding to 0
+    void deleteBuffer(GLuint buffer)
+    {
+        for (auto binding : { &_arrayBuffer, &_elementBuffer, &_indirectBuffer, &_uniformBuffer })
+        {
+            if (*binding == buffer)
+            {
+                *binding = 0;
+            }
+        }
+        for (auto &range : _uniformRanges)
+        {
+            if (range.buffer == buffer)
+            {
+                range = { 0, 0, 0 };
+            }
+        }
+
+        glDeleteBuffers(1, &buffer);
+    }
+
+    void deleteVertexArray(GLuint vertexArray)
+    {
+        if (_vertexArray == vertexArray)
+        {
+            _vertexArray = 0;
+            _elementBuffer = Unknown;
+        }
+
+        glDeleteVertexArrays(1, &vertexArray);
+    }
+
+    // A program that is in use stays in use after deleting it, but its name
+    // can be reused once it is not, so forget it
+    void deleteProgram(GLuint program)
+    {
+        if (_program == program)
+        {
+            _program = Unknown;
+        }
+
+        glDeleteProgram(program);
+    }
+
+    StateCounters const &counters() const
+    {
+        return _counters;
+    }
+
+    void resetCounters()
+    {
+        _counters = { 0, 0 };
+    }
+};
+
+// The state cache of the GL context
+inline StateCache &stateCache()
+{
+    static StateCache cache;
+
+    return cache;
+}
+
+#endif // GLSTATE_H
@@ -0,0 +1,303 @@
+#ifndef GLUNIFORM_H
+#define GLUNIFORM_H
+
+#include "glad/glad.h"
+#include "glbuffer.h"
+#include "glmath.h"
+#include "glstate.h"
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
+
+// Base alignment and size of a member of a std140 uniform block
+template <typename T>
+struct Std140Traits
+{
+    static_assert(sizeof(T) == 0, "no std140 layout known for this type, specialize Std140Traits");
+};
+
+template <>
+struct Std140Traits<float>
+{
+    static const size_t alignment = 4;
+    static const size_t size = 4;
+};
+
+template <>
+struct Std140Traits<GLint>
+{
+    static const size_t alignment = 4;
+    static const size_t size = 4;
+};
+
+template <>
+struct Std140Traits<GLuint>
+{
+    static const size_t alignment = 4;
+    static const size_t size = 4;
+};
+
+// A vec3 is aligned like a vec4, but a scalar can follow it in the last 4 bytes
+template <>
+struct Std140Traits<glm::vec3>
+{
+    static const size_t alignment = 16;
+    static const size_t size = 12;
+};
+
+template <>
+struct Std140Traits<glm::vec4>
+{
+    static const size_t alignment = 16;
+    static const size_t size = 16;
+};
+
+// Four vec4 columns
+template <>
+struct Std140Traits<glm::mat4>
+{
+    static const size_t alignment = 16;
+    static const size_t size = 64;
+};
+
+// One member of a uniform block struct: its type and its offsetof()
+template <typename T, size_t Offset>
+struct UniformMember
+{
+    typedef T type;
+
+    static const size_t offset = Offset;
+};
+
+namespace detail
+{
+
+// True when every member is where std140 puts it: at the first offset after the
+// previous member that is a multiple of its base alignment
+constexpr bool std140(std::initializer_list<size_t> offsets, std::initializer_list<size_t> alignments, std::initializer_list<size_t> sizes)
+{
+    size_t next = 0;
+    for (size_t i = 0; i < offsets.size(); i++)
+    {
+        auto alignment = alignments.begin()[i];
+        auto expected = (next + alignment - 1) / alignment * alignment;
+        if (offsets.begin()[i] != expected)
+        {
+            return false;
+        }
+
+        next = expected + sizes.begin()[i];
+    }
+
+    return true;
+}
+
+}
+
+// Compile-time check that a struct matches a std140 uniform block with the
+// same members in the same order:
+//
+//     struct MyBlockLayout : UniformBlock<MyBlock,
+//         UniformMember<decltype(MyBlock::a), offsetof(MyBlock, a)>, ...>
+//     { };
+//
+// UniformBuffer and UniformRing take the layout, not the struct, so every
+// struct that gets uploaded has been checked.
+template <typename Block, typename... Members>
+struct UniformBlock
+{
+    static_assert(std::is_standard_layout<Block>::value, "uniform block types must be standard layout to be uploaded as they are");
+    static_assert(sizeof...(Members) > 0, "a uniform block needs members");
+    static_assert(detail::std140({ Members::offset... }, { Std140Traits<typename Members::type>::alignment... }, { Std140Traits<typename Members::type>::size... }),
+                  "uniform block members are not at their std140 offsets, reorder them or add padding");
+
+    typedef Block type;
+
+    // std140 rounds the size of a block up to a multiple of a vec4
+    static const GLsizeiptr size = GLsizeiptr((sizeof(Block) + 15) / 16 * 16);
+};
+
+// A uniform block that changes at most once per frame, like the camera. It is
+// bound to its binding point once in setup(), update() replaces the contents
+// without binding anything.
+template <typename Layout>
+class UniformBuffer
+{
+    typedef typename Layout::type Block;
+
+    GLuint _bufferId;
+    GLuint _binding;
+
+public:
+    UniformBuffer()
+        : _bufferId(0), _binding(0)
+    { }
+
+    virtual ~UniformBuffer() { }
+
+    void setup(GLuint binding)
+    {
+        _binding = binding;
+
+        glGenBuffers(1, &_bufferId);
+        stateCache().bindBuffer(GL_UNIFORM_BUFFER, _bufferId);
+        glBufferData(GL_UNIFORM_BUFFER, Layout::size, nullptr, GL_DYNAMIC_DRAW);
+
+        bind();
+    }
+
+    // Orphans the buffer, so draws of the last frame that still read the old
+    // contents do not stall the upload
+    void update(Block const &block)
+    {
+        stateCache().bindBuffer(GL_UNIFORM_BUFFER, _bufferId);
+        glBufferData(GL_UNIFORM_BUFFER, Layout::size, nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+    }
+
+    // Only needed when something else was bound to the binding point since setup()
+    void bind()
+    {
+        stateCache().bindBufferBase(GL_UNIFORM_BUFFER, _binding, _bufferId);
+    }
+
+    void cleanup()
+    {
+        if (_bufferId != 0)
+        {
+            stateCache().deleteBuffer(_bufferId);
+            _bufferId = 0;
+        }
+    }
+};
+
+// Uniform blocks that change with every draw, like the model matrix. All
+// blocks of a frame go into one region of a ring with a region per frame in
+// flight, in one mapped write, and each draw only binds its own range of it:
+//
+//     ring.beginFrame();
+//     for (auto &object : objects)
+//         object.block = ring.push(object.uniforms);
+//     ring.upload();
+//     for (auto &object : objects)
+//     {
+//         ring.bind(object.block);
+//         object.buffer.render();
+//     }
+//     ring.endFrame();
+template <typename Layout>
+class UniformRing
+{
+    typedef typename Layout::type Block;
+
+    static const int FramesInFlight = 3;
+
+    GLuint _bufferId;
+    GLuint _binding;
+    GLsizeiptr _stride;
+    int _blocksPerFrame;
+    int _count;
+    int _region;
+    GLsync _fences[FramesInFlight];
+    char *_mapped;
+
+    GLintptr offset(int index) const
+    {
+        return GLintptr(_region * _blocksPerFrame + index) * _stride;
+    }
+
+public:
+    UniformRing()
+        : _bufferId(0), _binding(0), _stride(0), _blocksPerFrame(0), _count(0), _region(0),
+          _fences(), _mapped(nullptr)
+    { }
+
+    virtual ~UniformRing() { }
+
+    // Size it for the most draws of a frame
+    void setup(GLuint binding, int blocksPerFrame)
+    {
+        _binding = binding;
+        _blocksPerFrame = blocksPerFrame;
+
+        // Every range that is bound has to start at a multiple of the alignment
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        _stride = (Layout::size + alignment - 1) / alignment * alignment;
+
+        glGenBuffers(1, &_bufferId);
+        stateCache().bindBuffer(GL_UNIFORM_BUFFER, _bufferId);
+        glBufferData(GL_UNIFORM_BUFFER, _stride * _blocksPerFrame * FramesInFlight, nullptr, GL_STREAM_DRAW);
+    }
+
+    // Waits until the GPU is done with the region of this frame, which only
+    // blocks when the CPU runs more than FramesInFlight frames ahead, and maps it
+    void beginFrame()
+    {
+        waitFence(_fences[_region]);
+
+        _count = 0;
+
+        stateCache().bindBuffer(GL_UNIFORM_BUFFER, _bufferId);
+        _mapped = reinterpret_cast<char*>(glMapBufferRange(GL_UNIFORM_BUFFER, offset(0), _stride * _blocksPerFrame,
+                                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    }
+
+    // Copies the block into the region of this frame and returns its index for
+    // bind(), or -1 when the region is full
+    int push(Block const &block)
+    {
+        if (_mapped == nullptr || _count == _blocksPerFrame)
+        {
+            return -1;
+        }
+
+        std::memcpy(_mapped + GLintptr(_count) * _stride, &block, sizeof(Block));
+
+        return _count++;
+    }
+
+    // Call after the last push() of the frame, before drawing
+    void upload()
+    {
+        if (_mapped != nullptr)
+        {
+            stateCache().bindBuffer(GL_UNIFORM_BUFFER, _bufferId);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+            _mapped = nullptr;
+        }
+    }
+
+    void bind(int index)
+    {
+        stateCache().bindBufferRange(GL_UNIFORM_BUFFER, _binding, _bufferId, offset(index), _stride);
+    }
+
+    void endFrame()
+    {
+        _fences[_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        _region = (_region + 1) % FramesInFlight;
+    }
+
+    void cleanup()
+    {
+        upload();
+
+        for (auto &fence : _fences)
+        {
+            if (fence != nullptr)
+            {
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+        }
+
+        if (_bufferId != 0)
+        {
+            stateCache().deleteBuffer(_bufferId);
+            _bufferId = 0;
+        }
+    }
+};
+
+#endif // GLUNIFORM_H
@@ -0,0 +1,97 @@
+/*
+ * == COMPILING ==
+ *
+ * To compile this file with MinGW on Windows, run the following command:
+ *     g++ -std=c++14 -Wall -lopengl32 -lgdi32 -Iinclude
+ *
+ * == DESCRIPTION ==
+ *
+ * This example shows how to render 100.000 colored squares with a single instanced draw call.
+ *
+ */
+
+#define EXAMPLE_NAME __FILE__
+
+#define APPLICATION_IMPLEMENTATION
+#include "include/application.h"
+#include "include/glmath.h"
+#include "include/glshader.h"
+#include "include/glbuffer.h"
+
+static const int Columns = 400;
+static const int Rows = 250;
+
+static struct {
+    glm::mat4 matrix;
+    ShaderType shader;
+    BufferType vertexBuffer;
+} State;
+
+bool Startup()
+{
+    std::cout << EXAMPLE_NAME << " startup()\n";
+
+    glClearColor(0.0f, 0.8f, 1.0f, 1.0f);
+
+    State.shader.compileDefaultInstancedShader();
+
+    State.vertexBuffer
+        .color(glm::vec4(0.0f, 1.0f, 1.0f, 1.0f)).vertex(glm::vec3(-0.4f, -0.4f, 0.0f))
+        .color(glm::vec4(1.0f, 1.0f, 0.0f, 1.0f)).vertex(glm::vec3(-0.4f, 0.4f, 0.0f))
+        .color(glm::vec4(1.0f, 0.0f, 1.0f, 1.0f)).vertex(glm::vec3(0.4f, 0.4f, 0.0f))
+        .color(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)).vertex(glm::vec3(0.4f, -0.4f, 0.0f))
+        .setup(GL_TRIANGLE_FAN, State.shader);
+
+    // One model matrix and tint per square
+    std::vector<InstanceType> instances;
+    instances.reserve(Columns * Rows);
+    for (int y = 0; y < Rows; y++)
+    {
+        for (int x = 0; x < Columns; x++)
+        {
+            auto position = glm::vec3(float(x - Columns / 2), float(y - Rows / 2), 0.0f);
+            auto tint = glm::vec4(float(x) / float(Columns), float(y) / float(Rows), 1.0f, 1.0f);
+            instances.push_back(InstanceType({ glm::translate(position), tint }));
+        }
+    }
+
+    State.vertexBuffer.setupInstances(State.shader);
+    State.vertexBuffer.updateInstances(instances.data(), int(instances.size()));
+
+    return true;
+}
+
+void Resize(int width, int height)
+{
+    std::cout << EXAMPLE_NAME << " resize()\n";
+    glViewport(0, 0, width, height);
+
+    // Calculate the projection and view matrix
+    State.matrix = glm::perspective(glm::radians(90.0f), float(width) / float(height), 0.1f, 4096.0f) * glm::lookAt(glm::vec3(0.0f, -60.0f, 160.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+void Destroy()
+{
+    std::cout << EXAMPLE_NAME << " destroy()\n";
+}
+
+bool Tick()
+{
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Select shader and upload projection and view matrix into it
+    State.shader.use();
+    State.shader.setupMatrices(State.matrix);
+
+    // All squares in one draw call
+    State.vertexBuffer.renderInstanced(Columns * Rows);
+
+    return true; // to keep running
+}
+
+int main(int argc, char *argv[])
+{
+    auto app = Application::Create(Startup, Resize, Destroy);
+
+    return app->Run(Tick);
+}
@@ -0,0 +1,178 @@
+/*
+ * == COMPILING ==
+ *
+ * To compile this file with MinGW on Windows, run the following command:
+ *     g++ -std=c++14 -Wall -lopengl32 -lgdi32 -Iinclude
+ *
+ * == DESCRIPTION ==
+ *
+ * This example shows how to draw 10.000 squares with their own model matrix and color from uniform blocks, with
+ * one buffer range bind per draw instead of uploading every uniform.
+ *
+ */
+
+#define EXAMPLE_NAME __FILE__
+
+#define APPLICATION_IMPLEMENTATION
+#include "include/application.h"
+#include "include/glmath.h"
+#include "include/glshader.h"
+#include "include/glbuffer.h"
+#include "include/gluniform.h"
+
+static const int Columns = 100;
+static const int Rows = 100;
+
+// Binding points of the uniform blocks
+static const GLuint CameraBinding = 0;
+static const GLuint ObjectBinding = 1;
+
+struct CameraBlock
+{
+    glm::mat4 viewProjection;
+};
+
+struct CameraBlockLayout : UniformBlock<CameraBlock,
+    UniformMember<decltype(CameraBlock::viewProjection), offsetof(CameraBlock, viewProjection)>>
+{ };
+
+struct ObjectBlock
+{
+    glm::mat4 model;
+    glm::vec4 tint;
+};
+
+struct ObjectBlockLayout : UniformBlock<ObjectBlock,
+    UniformMember<decltype(ObjectBlock::model), offsetof(ObjectBlock, model)>,
+    UniformMember<decltype(ObjectBlock::tint), offsetof(ObjectBlock, tint)>>
+{ };
+
+static struct {
+    glm::mat4 matrix;
+    ShaderType shader;
+    BufferType vertexBuffer;
+    UniformBuffer<CameraBlockLayout> camera;
+    UniformRing<ObjectBlockLayout> objects;
+    std::vector<ObjectBlock> squares;
+    std::vector<int> blocks;
+} State;
+
+bool Startup()
+{
+    std::cout << EXAMPLE_NAME << " startup()\n";
+
+    glClearColor(0.0f, 0.8f, 1.0f, 1.0f);
+
+    std::string const vshader(
+                "#version 150\n"
+
+                "in vec3 vertex;"
+                "in vec4 color;"
+
+                "layout(std140) uniform Camera"
+                "{"
+                "    mat4 viewProjection;"
+                "};"
+
+                "layout(std140) uniform Object"
+                "{"
+                "    mat4 model;"
+                "    vec4 tint;"
+                "};"
+
+                "out vec4 f_color;"
+
+                "void main()"
+                "{"
+                "    gl_Position = viewProjection * model * vec4(vertex.xyz, 1.0);"
+                "    f_color = color * tint;"
+                "}"
+                );
+
+    std::string const fshader(
+                "#version 150\n"
+
+                "in vec4 f_color;"
+                "out vec4 color;"
+
+                "void main()"
+                "{"
+                "   color = f_color;"
+                "}"
+                );
+
+    State.shader.compile(vshader, fshader);
+    State.shader.bindUniformBlock("Camera", CameraBinding);
+    State.shader.bindUniformBlock("Object", ObjectBinding);
+
+    State.vertexBuffer
+        .color(glm::vec4(0.0f, 1.0f, 1.0f, 1.0f)).vertex(glm::vec3(-0.4f, -0.4f, 0.0f))
+        .color(glm::vec4(1.0f, 1.0f, 0.0f, 1.0f)).vertex(glm::vec3(-0.4f, 0.4f, 0.0f))
+        .color(glm::vec4(1.0f, 0.0f, 1.0f, 1.0f)).vertex(glm::vec3(0.4f, 0.4f, 0.0f))
+        .color(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)).vertex(glm::vec3(0.4f, -0.4f, 0.0f))
+        .setup(GL_TRIANGLE_FAN, State.shader);
+
+    for (int y = 0; y < Rows; y++)
+    {
+        for (int x = 0; x < Columns; x++)
+        {
+            auto position = glm::vec3(float(x - Columns / 2), float(y - Rows / 2), 0.0f);
+            auto tint = glm::vec4(float(x) / float(Columns), float(y) / float(Rows), 1.0f, 1.0f);
+            State.squares.push_back(ObjectBlock({ glm::translate(position), tint }));
+        }
+    }
+    State.blocks.resize(State.squares.size());
+
+    State.camera.setup(CameraBinding);
+    State.objects.setup(ObjectBinding, int(State.squares.size()));
+
+    return true;
+}
+
+void Resize(int width, int height)
+{
+    std::cout << EXAMPLE_NAME << " resize()\n";
+    glViewport(0, 0, width, height);
+
+    // Calculate the projection and view matrix
+    State.matrix = glm::perspective(glm::radians(90.0f), float(width) / float(height), 0.1f, 4096.0f) * glm::lookAt(glm::vec3(0.0f, -30.0f, 60.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+void Destroy()
+{
+    std::cout << EXAMPLE_NAME << " destroy()\n";
+}
+
+bool Tick()
+{
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // The camera block is bound for good, this only replaces its contents
+    State.camera.update(CameraBlock({ State.matrix }));
+
+    // All object blocks of this frame in one write
+    State.objects.beginFrame();
+    for (size_t i = 0; i < State.squares.size(); i++)
+    {
+        State.blocks[i] = State.objects.push(State.squares[i]);
+    }
+    State.objects.upload();
+
+    State.shader.use();
+    for (auto block : State.blocks)
+    {
+        State.objects.bind(block);
+        State.vertexBuffer.render();
+    }
+
+    State.objects.endFrame();
+
+    return true; // to keep running
+}
+
+int main(int argc, char *argv[])
+{
+    auto app = Application::Create(Startup, Resize, Destroy);
+
+    return app->Run(Tick);
+}